@@ -93,6 +93,7 @@ cdef extern from "monome.h":
 	int monome_led_ring_all(monome_t *monome, unsigned int ring, unsigned int level)
 	int monome_led_ring_map(monome_t *monome, unsigned int ring, const uint8_t *levels)
 	int monome_led_ring_range(monome_t *monome, unsigned int ring, unsigned int start, unsigned int end, unsigned int level)
+	int monome_led_ring_frame(monome_t *monome, unsigned int ring, const uint8_t *levels)
 
 __all__ = [
 	# constants
@@ -473,3 +474,15 @@ cdef class Monome:
 	def led_ring_range(self, uint ring, uint start, uint end, uint level):
 		level = check_level(level)
 		monome_led_ring_range(self.monome, ring, start, end, level)
+
+	def led_ring_frame(self, uint ring, list[int] levels):
+		cdef uint8_t levels_arr[ARC_RING_SIZE]
+
+		levels_iter = iter(levels)
+
+		for idx in range(ARC_RING_SIZE):
+			level = next(levels_iter)
+			level = check_level(level)
+			levels_arr[idx] = level
+
+		monome_led_ring_frame(self.monome, ring, levels_arr)
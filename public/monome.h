@@ -50,6 +50,17 @@ typedef enum {
 	MONOME_ROTATE_270  = 3
 } monome_rotate_t;
 
+/* how drawn levels are combined with what's already there. a level of 0
+   leaves what's underneath alone in every mode but MONOME_BLEND_MASK,
+   where it clears it. */
+
+typedef enum {
+	MONOME_BLEND_REPLACE = 0, /* lit leds replace what's underneath */
+	MONOME_BLEND_MAX     = 1, /* the brighter of the two */
+	MONOME_BLEND_ADD     = 2, /* summed, saturating at 15 */
+	MONOME_BLEND_MASK    = 3  /* only what's underneath lit leds is kept */
+} monome_blend_t;
+
 typedef struct monome monome_t; /* opaque data type */
 typedef struct monome_event monome_event_t;
 
@@ -80,6 +91,28 @@ struct monome_event {
 	};
 };
 
+/* what has gone over the wire to and from a device */
+
+typedef struct monome_io_stats {
+	uint64_t writes;
+	uint64_t bytes_written;
+
+	uint64_t reads;
+	uint64_t bytes_read;
+} monome_io_stats_t;
+
+/*
+ * besides a tty or an osc url, monome_device can be
+ *
+ *   tile:<device>@<x>,<y>[,<rotation>];<device>@<x>,<y>[,<rotation>];...
+ *
+ * which opens each device, rotates it by the given number of degrees and
+ * places its top left corner at (x, y) (multiples of 8) on one virtual grid.
+ * the virtual grid can be at most 16x16, the size key state is kept for.
+ * its leds, framebuffer and events cover all of the devices, and
+ * closing it closes them. the virtual grid itself can't be rotated,
+ * monome_set_rotation() does nothing on it.
+ */
 monome_t *monome_open(const char *monome_device, ...);
 void monome_close(monome_t *monome);
 
@@ -92,6 +125,7 @@ const char *monome_get_friendly_name(monome_t *monome);
 const char *monome_get_proto(monome_t *monome);
 int monome_get_rows(monome_t *monome);
 int monome_get_cols(monome_t *monome);
+void monome_get_io_stats(monome_t *monome, monome_io_stats_t *stats);
 
 int monome_register_handler(monome_t *monome, monome_event_type_t event_type,
                             monome_event_callback_t, void *user_data);
@@ -102,6 +136,27 @@ int monome_event_handle_next(monome_t *monome);
 void monome_event_loop(monome_t *monome);
 int monome_get_fd(monome_t *monome);
 
+/*
+ * some protocols read ahead of the event they return, so events can be
+ * waiting even though monome_get_fd() isn't readable. if you poll the fd
+ * yourself, check this before going back to sleep.
+ */
+int monome_event_pending(monome_t *monome);
+
+/**
+ * key state
+ *
+ * libmonome keeps track of which keys are currently held. x and y are in
+ * the current rotation, like event coordinates. the snapshot is taken in the
+ * device's own orientation: bit x of rows[y] is set while key (x, y) is held,
+ * and the number of held keys is returned. keys beyond 16x16 are not tracked.
+ *
+ * these are safe to call from any thread.
+ */
+int monome_key_get(monome_t *monome, unsigned int x, unsigned int y);
+unsigned int monome_key_count(monome_t *monome);
+unsigned int monome_key_snapshot(monome_t *monome, uint16_t rows[16]);
+
 /**
  * led grid commands
  */
@@ -131,6 +186,84 @@ int monome_event_get_grid(const monome_event_t *e,
 			  unsigned int *out_x, unsigned int *out_y,
 			  monome_t **monome);
 
+/**
+ * led framebuffer
+ *
+ * a rows * cols array of levels (row-major, in the current rotation) kept
+ * by libmonome. draw into it, mark what you touched as dirty, and flush:
+ * only leds that differ from what was last sent go out, using whichever
+ * messages the device's protocol can express them in most cheaply.
+ *
+ * the framebuffer assumes it is the only thing drawing on the grid. changing
+ * the rotation forces a full redraw, and clears the framebuffer if rows and
+ * columns traded places.
+ *
+ * over osc, the grid's size is asked for on open and arrives along with
+ * events. until it has, monome_get_rows() and monome_get_cols() return 0
+ * and there's no framebuffer to be had.
+ */
+uint8_t *monome_led_frame_get(monome_t *monome);
+int monome_led_frame_set(monome_t *monome, unsigned int x, unsigned int y,
+                         unsigned int level);
+int monome_led_frame_dirty(monome_t *monome, unsigned int x, unsigned int y,
+                           unsigned int width, unsigned int height);
+int monome_led_frame_flush(monome_t *monome);
+
+/*
+ * moving things around in the framebuffer. these mark what they touch as
+ * dirty, and since the flush only sends what differs from the grid, a
+ * scroll costs no more than the leds it actually changed.
+ *
+ * copy moves a rectangle to (dst_x, dst_y), overlapping or not. shift
+ * scrolls the contents of a rectangle by (dx, dy), losing what falls off
+ * its edge and filling what's uncovered with fill. blit draws a
+ * width * height block of levels, rows stride bytes apart, in at (x, y).
+ */
+int monome_led_frame_copy(monome_t *monome, unsigned int src_x,
+                          unsigned int src_y, unsigned int width,
+                          unsigned int height, unsigned int dst_x,
+                          unsigned int dst_y);
+int monome_led_frame_shift(monome_t *monome, unsigned int x, unsigned int y,
+                           unsigned int width, unsigned int height,
+                           int dx, int dy, unsigned int fill);
+int monome_led_frame_blit(monome_t *monome, unsigned int x, unsigned int y,
+                          unsigned int width, unsigned int height,
+                          const uint8_t *levels, size_t stride,
+                          monome_blend_t blend);
+
+/*
+ * page flipping, for drawing on one thread and flushing on another.
+ * monome_led_frame_begin() returns a page holding the last frame you
+ * committed: draw the whole next frame into it, then publish it with
+ * monome_led_frame_commit(), which never blocks. each flush sends the
+ * newest committed frame, never a half-drawn one, and diffs it against
+ * the one it sent before, so there's nothing to mark dirty.
+ *
+ * committed frames replace the contents of monome_led_frame_get(), don't
+ * draw there (or into layers) as well. call monome_led_frame_begin() once
+ * before the flushing thread starts, since that's when the pages are set
+ * up. the page is yours until the next commit. the rotation can't be
+ * changed safely while either thread is running, stop both first.
+ */
+uint8_t *monome_led_frame_begin(monome_t *monome);
+int monome_led_frame_commit(monome_t *monome);
+
+/**
+ * led layers
+ *
+ * up to 8 rows * cols level buffers, laid out like the framebuffer, which
+ * are blended bottom (layer 0) to top into it on monome_led_frame_flush().
+ * only the 8x8 tiles marked dirty since the last flush are recomposited.
+ * once a layer has been asked for, the framebuffer belongs to the layers
+ * and shouldn't be drawn into directly. new layers blend with
+ * MONOME_BLEND_REPLACE.
+ */
+uint8_t *monome_led_layer_get(monome_t *monome, unsigned int layer);
+int monome_led_layer_blend(monome_t *monome, unsigned int layer,
+                           monome_blend_t blend);
+int monome_led_layer_dirty(monome_t *monome, unsigned int x, unsigned int y,
+                           unsigned int width, unsigned int height);
+
 /**
  * led ring commands
  */
@@ -146,12 +279,123 @@ int monome_led_ring_range(monome_t *monome, unsigned int ring,
                           unsigned int level);
 int monome_led_ring_intensity(monome_t *monome, unsigned int brightness);
 
+/*
+ * takes all 64 levels of a ring and sends only what changed since it was
+ * last drawn, as whichever mix of set, range, all and map messages comes to
+ * the fewest bytes. the other ring calls are tracked, so they can be mixed
+ * freely with this one. returns 0, or -1 if a write to the device failed.
+ */
+int monome_led_ring_frame(monome_t *monome, unsigned int ring,
+                          const uint8_t *levels);
+
+/**
+ * ring drawing
+ *
+ * these render into a 64-level ring buffer, ready for
+ * monome_led_ring_frame(). positions are fractions of a turn clockwise from
+ * led 0 and wrap around, so an arc from 0.875 to 0.125 covers the top
+ * quarter. ends that fall between leds are drawn proportionally dimmer.
+ */
+
+void monome_ring_draw_arc(uint8_t *levels, float from, float to,
+                          unsigned int level, monome_blend_t blend);
+void monome_ring_draw_gradient(uint8_t *levels, float from, float to,
+                               unsigned int level_from, unsigned int level_to,
+                               monome_blend_t blend);
+void monome_ring_draw_pointer(uint8_t *levels, float position,
+                              unsigned int level, monome_blend_t blend);
+void monome_ring_blend(uint8_t *levels, const uint8_t *src,
+                       monome_blend_t blend);
+
+/**
+ * encoder settings
+ *
+ * with coalescing enabled, consecutive deltas for the same encoder are summed
+ * into a single MONOME_ENCODER_DELTA event. deltas that have already arrived
+ * are always folded in; window_msec is how long to wait for more before the
+ * event is delivered (0 to not wait at all).
+ *
+ * coalescing reads ahead of the event it returns, so if you drive the event
+ * loop yourself, keep calling monome_event_handle_next() until it returns 0
+ * rather than once per wakeup. it returns 1 for every event it consumes,
+ * whether or not a handler was registered for it.
+ */
+int monome_set_encoder_coalescing(monome_t *monome, unsigned int enable,
+                                  unsigned int window_msec);
+
 /**
  * tilt commands
  */
 int monome_tilt_enable(monome_t *monome, unsigned int sensor);
 int monome_tilt_disable(monome_t *monome, unsigned int sensor);
 
+/**
+ * drop tilt events from a sensor before they reach the event queue. at most
+ * max_rate events per second are delivered, and only once some axis has
+ * moved by at least threshold since the last delivered event. pass 0 for
+ * either to turn that check off.
+ *
+ * the last position the rate limit drops is held and delivered once the
+ * interval is up, so the final resting position always arrives. it comes
+ * from monome_event_next(); monome_event_loop() wakes up for it, and
+ * monome_schedule_run()'s timeout covers it if you run your own loop.
+ */
+int monome_tilt_set_filter(monome_t *monome, unsigned int sensor,
+                           unsigned int max_rate, unsigned int threshold);
+
+/**
+ * output batching
+ *
+ * with batching enabled, led commands may be held back and sent in bulk
+ * (over osc, as bundles no larger than a single datagram) until
+ * monome_flush() is called. monome_led_frame_flush() flushes as well.
+ * disabling batching flushes anything still pending.
+ */
+int monome_set_output_batching(monome_t *monome, unsigned int enable);
+int monome_flush(monome_t *monome);
+
+/**
+ * scheduled led updates
+ *
+ * led commands issued between monome_schedule_begin() and
+ * monome_schedule_end() take effect at `when`, a time on the
+ * monome_time_usec() clock, rather than right away. over osc they're sent
+ * immediately as a bundle with that timetag. for serial devices they're held
+ * in libmonome and written out at the deadline by monome_event_loop(), or
+ * by monome_schedule_run() if you drive the event loop yourself.
+ */
+uint64_t monome_time_usec(void);
+
+int monome_schedule_begin(monome_t *monome, uint64_t when);
+int monome_schedule_end(monome_t *monome);
+
+/* writes out whatever is due. returns how many msec until the next update
+   (or held back tilt event) is due, a good timeout for poll(), or -1 if
+   nothing is scheduled. */
+int monome_schedule_run(monome_t *monome);
+
+/**
+ * sharing a device between processes (linux only)
+ *
+ * monome_shm_publish() keeps the device open in this process and listens on
+ * a unix socket at path. other processes open it with
+ *
+ *   monome_open("shm:<path>")
+ *
+ * and get a grid of the same size which draws into shared memory, with no
+ * copy through a socket. up to four clients are composited into layers 0-3
+ * with MONOME_BLEND_MAX, and each gets every event. set the rotation before
+ * publishing, clients see the grid as it is then and can't rotate it
+ * themselves.
+ *
+ * the broker wakes on monome_shm_get_fd(), and should then call
+ * monome_shm_service(), which also reads the device and runs this process's
+ * own handlers. returns the number of things serviced, or -1.
+ */
+int monome_shm_publish(monome_t *monome, const char *path);
+int monome_shm_get_fd(monome_t *monome);
+int monome_shm_service(monome_t *monome);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2011 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "internal.h"
+#include "blend.h"
+
+/**
+ * private
+ */
+
+static uint8_t blend_1(uint8_t d, uint8_t s, monome_blend_t mode) {
+	switch( mode ) {
+	case MONOME_BLEND_REPLACE:
+		return s ? s : d;
+
+	case MONOME_BLEND_MAX:
+		return (s > d) ? s : d;
+
+	case MONOME_BLEND_ADD:
+		return (d + s > 15) ? 15 : d + s;
+
+	case MONOME_BLEND_MASK:
+		return s ? d : 0;
+	}
+
+	return d;
+}
+
+#if defined(__SSE2__)
+#define HAVE_BLEND_16
+
+static void blend_16(uint8_t *dst, const uint8_t *src, monome_blend_t mode) {
+	__m128i d = _mm_loadu_si128((const __m128i *) dst);
+	__m128i s = _mm_loadu_si128((const __m128i *) src);
+	__m128i clear = _mm_cmpeq_epi8(s, _mm_setzero_si128());
+
+	switch( mode ) {
+	case MONOME_BLEND_REPLACE:
+		/* s is zero wherever d shows through, so or-ing is enough */
+		d = _mm_or_si128(_mm_and_si128(clear, d), s);
+		break;
+
+	case MONOME_BLEND_MAX:
+		d = _mm_max_epu8(d, s);
+		break;
+
+	case MONOME_BLEND_ADD:
+		d = _mm_min_epu8(_mm_adds_epu8(d, s), _mm_set1_epi8(15));
+		break;
+
+	case MONOME_BLEND_MASK:
+		d = _mm_andnot_si128(clear, d);
+		break;
+	}
+
+	_mm_storeu_si128((__m128i *) dst, d);
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_BLEND_16
+
+static void blend_16(uint8_t *dst, const uint8_t *src, monome_blend_t mode) {
+	uint8x16_t d = vld1q_u8(dst);
+	uint8x16_t s = vld1q_u8(src);
+	uint8x16_t clear = vceqq_u8(s, vdupq_n_u8(0));
+
+	switch( mode ) {
+	case MONOME_BLEND_REPLACE:
+		d = vorrq_u8(vandq_u8(clear, d), s);
+		break;
+
+	case MONOME_BLEND_MAX:
+		d = vmaxq_u8(d, s);
+		break;
+
+	case MONOME_BLEND_ADD:
+		d = vminq_u8(vqaddq_u8(d, s), vdupq_n_u8(15));
+		break;
+
+	case MONOME_BLEND_MASK:
+		d = vbicq_u8(d, clear);
+		break;
+	}
+
+	vst1q_u8(dst, d);
+}
+#endif
+
+/**
+ * public
+ */
+
+void blend_levels(uint8_t *dst, const uint8_t *src, size_t count,
+                  monome_blend_t mode) {
+	size_t i = 0;
+
+#ifdef HAVE_BLEND_16
+	for( ; i + 16 <= count; i += 16 )
+		blend_16(&dst[i], &src[i], mode);
+#endif
+
+	for( ; i < count; i++ )
+		dst[i] = blend_1(dst[i], src[i], mode);
+}
@@ -0,0 +1,353 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for fileno */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "capture.h"
+
+#define CAPTURE_MAGIC   "mcap"
+#define CAPTURE_VERSION 1
+
+#define REPLAY_REALTIME_SUFFIX "?realtime"
+
+struct monome_capture {
+	FILE *file;
+	int replaying;
+
+	/* when the previous record was taken (capture) or became due (replay) */
+	uint64_t last;
+
+	/* replay only */
+	int realtime;
+	int eof;
+
+	uint8_t *pos, *end;
+	uint8_t buf[UINT16_MAX];
+};
+
+/**
+ * capture
+ */
+
+static void put_u16le(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static void put_u32le(uint8_t *p, uint32_t v) {
+	put_u16le(p, v & 0xFFFF);
+	put_u16le(p + 2, v >> 16);
+}
+
+void monome_capture_start(monome_t *monome, const char *dev) {
+	monome_capture_t *cap;
+	const char *path;
+	char *serial;
+	uint8_t hdr[6];
+	size_t len;
+
+	if( !(path = getenv("MONOME_CAPTURE")) || !*path )
+		return;
+
+	if( !(serial = monome_platform_get_dev_serial(dev)) )
+		return;
+
+	if( !(cap = m_calloc(1, sizeof(*cap))) )
+		goto err_nomem;
+
+	if( !(cap->file = fopen(path, "wb")) ) {
+		perror("libmonome: could not open capture file");
+		goto err_fopen;
+	}
+
+	len = strlen(serial);
+	if( len > UINT8_MAX )
+		len = UINT8_MAX;
+
+	memcpy(hdr, CAPTURE_MAGIC, 4);
+	hdr[4] = CAPTURE_VERSION;
+	hdr[5] = len;
+
+	if( fwrite(hdr, sizeof(hdr), 1, cap->file) != 1
+		|| fwrite(serial, len, 1, cap->file) != 1 ) {
+		perror("libmonome: could not write capture header");
+		goto err_write;
+	}
+
+	m_free(serial);
+
+	cap->last = m_time_usec();
+	monome->capture = cap;
+	return;
+
+err_write:
+	fclose(cap->file);
+err_fopen:
+	m_free(cap);
+err_nomem:
+	m_free(serial);
+}
+
+void monome_capture_record(monome_t *monome, monome_capture_dir_t dir,
+                           const uint8_t *buf, size_t nbyte) {
+	monome_capture_t *cap = monome->capture;
+	uint8_t hdr[7];
+	uint64_t now;
+	size_t len;
+
+	if( !cap || cap->replaying )
+		return;
+
+	now = m_time_usec();
+
+	hdr[0] = dir;
+	put_u32le(&hdr[1], (now - cap->last > UINT32_MAX)
+	          ? UINT32_MAX : now - cap->last);
+	cap->last = now;
+
+	do {
+		len = (nbyte > UINT16_MAX) ? UINT16_MAX : nbyte;
+		put_u16le(&hdr[5], len);
+
+		if( fwrite(hdr, sizeof(hdr), 1, cap->file) != 1
+			|| fwrite(buf, len, 1, cap->file) != 1 ) {
+			perror("libmonome: error writing capture, stopping");
+			monome_capture_stop(monome);
+			return;
+		}
+
+		/* any remainder follows immediately */
+		put_u32le(&hdr[1], 0);
+
+		buf   += len;
+		nbyte -= len;
+	} while( nbyte );
+
+	/* keep the file usable if the process never gets to monome_close() */
+	fflush(cap->file);
+}
+
+/**
+ * replay
+ */
+
+int monome_replay_is_dev(const char *dev) {
+	return !strncmp(dev, MONOME_REPLAY_PREFIX, sizeof(MONOME_REPLAY_PREFIX) - 1);
+}
+
+/* returns the path of the capture file, which the caller should free, and
+   whether the device asked for realtime playback */
+static char *replay_parse_dev(const char *dev, int *realtime) {
+	const char *path, *query;
+	char *ret;
+	size_t len;
+
+	path = dev + sizeof(MONOME_REPLAY_PREFIX) - 1;
+	len  = strlen(path);
+
+	if( (query = strrchr(path, '?'))
+		&& !strcmp(query, REPLAY_REALTIME_SUFFIX) ) {
+		len = query - path;
+		*realtime = 1;
+	} else
+		*realtime = 0;
+
+	if( !(ret = m_malloc(len + 1)) )
+		return NULL;
+
+	memcpy(ret, path, len);
+	ret[len] = '\0';
+
+	return ret;
+}
+
+/* reads the header and leaves the file positioned at the first record */
+static char *replay_read_header(FILE *f) {
+	uint8_t hdr[6];
+	char *serial;
+
+	if( fread(hdr, sizeof(hdr), 1, f) != 1
+		|| memcmp(hdr, CAPTURE_MAGIC, 4) || hdr[4] != CAPTURE_VERSION ) {
+		fprintf(stderr, "libmonome: not a capture file\n");
+		return NULL;
+	}
+
+	if( !(serial = m_malloc(hdr[5] + 1)) )
+		return NULL;
+
+	if( hdr[5] && fread(serial, hdr[5], 1, f) != 1 ) {
+		m_free(serial);
+		return NULL;
+	}
+
+	serial[hdr[5]] = '\0';
+	return serial;
+}
+
+static FILE *replay_fopen(const char *dev, int *realtime) {
+	char *path;
+	FILE *f;
+
+	if( !(path = replay_parse_dev(dev, realtime)) )
+		return NULL;
+
+	if( !(f = fopen(path, "rb")) )
+		perror("libmonome: could not open capture file");
+
+	m_free(path);
+	return f;
+}
+
+char *monome_replay_get_serial(const char *dev) {
+	char *serial;
+	int realtime;
+	FILE *f;
+
+	if( !(f = replay_fopen(dev, &realtime)) )
+		return NULL;
+
+	serial = replay_read_header(f);
+	fclose(f);
+
+	return serial;
+}
+
+int monome_replay_start(monome_t *monome, const char *dev) {
+	monome_capture_t *cap;
+	char *serial;
+
+	if( !(cap = m_calloc(1, sizeof(*cap))) )
+		return -1;
+
+	if( !(cap->file = replay_fopen(dev, &cap->realtime)) )
+		goto err_fopen;
+
+	if( !(serial = replay_read_header(cap->file)) )
+		goto err_header;
+
+	m_free(serial);
+
+	cap->replaying = 1;
+	cap->pos = cap->end = cap->buf;
+	cap->last = m_time_usec();
+
+	/* a regular file always polls readable, so the usual wait_for_input()
+	   and event loop work unchanged */
+	monome->fd = fileno(cap->file);
+	monome->capture = cap;
+	return 0;
+
+err_header:
+	fclose(cap->file);
+err_fopen:
+	m_free(cap);
+	return -1;
+}
+
+int monome_replay_active(monome_t *monome) {
+	return monome->capture && monome->capture->replaying;
+}
+
+/* loads the next chunk that was read from the device, skipping writes. */
+static int replay_next_chunk(monome_capture_t *cap) {
+	uint8_t hdr[7];
+	uint64_t now;
+	size_t len;
+
+	do {
+		if( fread(hdr, sizeof(hdr), 1, cap->file) != 1 )
+			goto eof;
+
+		len = hdr[5] | (hdr[6] << 8);
+
+		if( len && fread(cap->buf, len, 1, cap->file) != 1 )
+			goto eof;
+
+		cap->last += (uint64_t) hdr[1] | (hdr[2] << 8) | (hdr[3] << 16)
+			| ((uint64_t) hdr[4] << 24);
+	} while( hdr[0] != CAPTURE_READ || !len );
+
+	if( cap->realtime ) {
+		now = m_time_usec();
+
+		/* m_sleep() is in msec, round up so we never deliver early */
+		if( cap->last > now )
+			m_sleep((cap->last - now + 999) / 1000);
+	}
+
+	cap->pos = cap->buf;
+	cap->end = cap->buf + len;
+	return 1;
+
+eof:
+	cap->eof = 1;
+	return 0;
+}
+
+int monome_replay_done(monome_t *monome) {
+	monome_capture_t *cap = monome->capture;
+	return cap->eof && cap->pos == cap->end;
+}
+
+ssize_t monome_replay_read(monome_t *monome, uint8_t *buf, size_t nbyte) {
+	monome_capture_t *cap = monome->capture;
+	ssize_t ret = 0;
+	size_t len;
+
+	while( nbyte ) {
+		if( cap->pos == cap->end
+			&& (cap->eof || !replay_next_chunk(cap)) )
+			break;
+
+		len = cap->end - cap->pos;
+		if( len > nbyte )
+			len = nbyte;
+
+		memcpy(buf, cap->pos, len);
+
+		cap->pos += len;
+		buf      += len;
+		nbyte    -= len;
+		ret      += len;
+	}
+
+	return ret;
+}
+
+/**
+ * common
+ */
+
+void monome_capture_stop(monome_t *monome) {
+	monome_capture_t *cap = monome->capture;
+
+	if( !cap )
+		return;
+
+	fclose(cap->file);
+	m_free(cap);
+
+	monome->capture = NULL;
+}
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "blend.h"
+#include "framebuffer.h"
+#include "compositor.h"
+
+#define TILE_COLS(c) ((c)->cols >> 3)
+
+/**
+ * private
+ */
+
+static monome_compositor_t *compositor_get(monome_t *monome) {
+	monome_compositor_t *c = monome->compositor;
+
+	if( c )
+		return c;
+
+	/* the framebuffer is what we draw into, and it vets the dimensions */
+	if( !monome_framebuffer_get(monome) )
+		return NULL;
+
+	if( !(c = m_calloc(1, sizeof(monome_compositor_t))) )
+		return NULL;
+
+	c->rows = monome->fb->rows;
+	c->cols = monome->fb->cols;
+
+	monome->compositor = c;
+	return c;
+}
+
+/* recomposite one row of a run of adjacent dirty tiles. runs are as long as
+   we can make them so the blend kernels get whole vectors to chew on. */
+static void compose_span(monome_compositor_t *c, uint8_t *out, size_t offset,
+                         size_t len) {
+	uint_t l;
+
+	memset(&out[offset], 0, len);
+
+	for( l = 0; l < MONOME_LAYER_MAX; l++ )
+		if( c->layers[l] )
+			blend_levels(&out[offset], &c->layers[l][offset], len,
+			             c->blend[l]);
+}
+
+/**
+ * compositor
+ */
+
+uint8_t *monome_compositor_layer_get(monome_t *monome, uint_t layer) {
+	monome_compositor_t *c;
+
+	if( layer >= MONOME_LAYER_MAX || !(c = compositor_get(monome)) )
+		return NULL;
+
+	if( !c->layers[layer] ) {
+		if( !(c->layers[layer] = m_calloc(c->rows * c->cols, 1)) )
+			return NULL;
+
+		c->blend[layer] = MONOME_BLEND_REPLACE;
+	}
+
+	return c->layers[layer];
+}
+
+int monome_compositor_set_blend(monome_t *monome, uint_t layer,
+                                monome_blend_t blend) {
+	monome_compositor_t *c;
+
+	if( !monome_compositor_layer_get(monome, layer) )
+		return -1;
+
+	c = monome->compositor;
+
+	if( c->blend[layer] != blend ) {
+		c->blend[layer] = blend;
+		monome_compositor_mark_dirty(monome, 0, 0, c->cols, c->rows);
+	}
+
+	return 0;
+}
+
+void monome_compositor_mark_dirty(monome_t *monome, uint_t x, uint_t y,
+                                  uint_t w, uint_t h) {
+	monome_compositor_t *c = monome->compositor;
+	uint_t tx, ty;
+
+	if( !c || x >= c->cols || y >= c->rows || !w || !h )
+		return;
+
+	if( w > c->cols - x )
+		w = c->cols - x;
+
+	if( h > c->rows - y )
+		h = c->rows - y;
+
+	for( ty = y >> 3; ty <= (y + h - 1) >> 3; ty++ )
+		for( tx = x >> 3; tx <= (x + w - 1) >> 3; tx++ )
+			c->dirty |= 1ULL << ((ty * TILE_COLS(c)) + tx);
+}
+
+/* rebuilds the dirty tiles of the framebuffer from the layers, and hands
+   them on to the framebuffer as dirty in turn */
+void monome_compositor_compose(monome_t *monome) {
+	monome_compositor_t *c = monome->compositor;
+	uint_t tx, ty, run, y;
+	uint64_t band;
+
+	if( !c || !c->dirty )
+		return;
+
+	for( ty = 0; ty < (c->rows >> 3); ty++ ) {
+		band = (c->dirty >> (ty * TILE_COLS(c))) & ((1ULL << TILE_COLS(c)) - 1);
+
+		for( tx = 0; band >> tx; tx += run ) {
+			if( !((band >> tx) & 1) ) {
+				run = 1;
+				continue;
+			}
+
+			for( run = 1; (band >> (tx + run)) & 1; run++ );
+
+			for( y = ty * 8; y < (ty + 1) * 8; y++ )
+				compose_span(c, monome->fb->levels, (y * c->cols) + (tx * 8),
+				             run * 8);
+
+			monome_framebuffer_mark_dirty(monome, tx * 8, ty * 8, run * 8, 8);
+		}
+	}
+
+	c->dirty = 0;
+}
+
+/* called when the rotation changes. like the framebuffer, layers are
+   cleared if rows and columns traded places. */
+void monome_compositor_reset(monome_t *monome) {
+	monome_compositor_t *c = monome->compositor;
+	uint_t l;
+
+	if( !c )
+		return;
+
+	if( c->rows != monome->fb->rows || c->cols != monome->fb->cols ) {
+		for( l = 0; l < MONOME_LAYER_MAX; l++ )
+			if( c->layers[l] )
+				memset(c->layers[l], 0, c->rows * c->cols);
+
+		c->rows = monome->fb->rows;
+		c->cols = monome->fb->cols;
+	}
+
+	monome_compositor_mark_dirty(monome, 0, 0, c->cols, c->rows);
+}
+
+void monome_compositor_free(monome_t *monome) {
+	monome_compositor_t *c = monome->compositor;
+	uint_t l;
+
+	if( !c )
+		return;
+
+	for( l = 0; l < MONOME_LAYER_MAX; l++ )
+		m_free(c->layers[l]);
+
+	m_free(c);
+	monome->compositor = NULL;
+}
@@ -0,0 +1,768 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "rotation.h"
+#include "monobright.h"
+#include "blend.h"
+#include "framebuffer.h"
+
+#define COST_INFINITE ((uint_t) -1)
+
+#define QUAD_COLS(fb) ((fb)->cols >> 3)
+#define QUAD_COUNT(fb) (QUAD_COLS(fb) * ((fb)->rows >> 3))
+#define LEVEL(fb, x, y) ((fb)->levels[((y) * (fb)->cols) + (x)])
+#define SHADOW(fb, x, y) ((fb)->shadow[((y) * (fb)->cols) + (x)])
+
+/* pages come from the allocator, so the low bit of their address is free */
+#define FB_FRESH ((uintptr_t) 1)
+
+/* the encodings we consider for a single quadrant */
+
+typedef enum {
+	ENCODE_NOTHING,
+	ENCODE_SET,
+	ENCODE_ROW,
+	ENCODE_COL,
+	ENCODE_MAP
+} fb_encoding_t;
+
+typedef struct {
+	fb_encoding_t how;
+	uint_t cost;
+
+	uint_t x, y;
+
+	/* bit c of diff[r] is set when led (x + c, y + r) needs updating */
+	uint8_t diff[8];
+} fb_plan_t;
+
+/**
+ * private
+ */
+
+static int fb_is_binary(const monome_led_costs_t *c, uint8_t level) {
+	return (c->flags & LED_MONOCHROME) || !level || level == 15;
+}
+
+static int fb_differs(const monome_led_costs_t *c, uint8_t level,
+                      uint8_t shadow) {
+	if( shadow == FB_UNKNOWN )
+		return 1;
+
+	if( c->flags & LED_MONOCHROME )
+		return reduce_level_to_bit(level) != reduce_level_to_bit(shadow);
+
+	return level != shadow;
+}
+
+/* whether the on/off variant of a message should be used over the level
+   variant. the on/off variant can only be used when every led it touches
+   is either fully on or fully off. */
+static int fb_use_binary(uint_t binary_cost, uint_t level_cost, int binary) {
+	if( !binary || !binary_cost )
+		return 0;
+
+	return !level_cost || binary_cost <= level_cost;
+}
+
+static uint_t fb_msg_cost(uint_t binary_cost, uint_t level_cost, int binary) {
+	uint_t cost;
+
+	cost = fb_use_binary(binary_cost, level_cost, binary)
+		? binary_cost : level_cost;
+
+	return (cost) ? cost : COST_INFINITE;
+}
+
+static uint_t fb_add_cost(uint_t a, uint_t b) {
+	if( a == COST_INFINITE || b == COST_INFINITE )
+		return COST_INFINITE;
+
+	return a + b;
+}
+
+/* the costs table describes the device in its native orientation, so when
+   rotation swaps rows and columns we have to swap the row and col costs. */
+static void fb_oriented_costs(monome_t *monome, monome_led_costs_t *c) {
+	uint_t t;
+
+	*c = *monome->led_costs;
+
+	if( !(ROTSPEC(monome).flags & ROW_COL_SWAP) )
+		return;
+
+	t = c->row; c->row = c->col; c->col = t;
+	t = c->level_row; c->level_row = c->level_col; c->level_col = t;
+}
+
+static void fb_line_span(const monome_framebuffer_t *fb,
+                         const monome_led_costs_t *c, int is_row,
+                         uint_t at, uint_t *start, uint_t *span) {
+	if( c->flags & LED_LINE_SPANS_GRID ) {
+		*start = 0;
+		*span = (is_row) ? fb->cols : fb->rows;
+	} else {
+		*start = at;
+		*span = 8;
+	}
+}
+
+static int fb_row_is_binary(const monome_framebuffer_t *fb,
+                            const monome_led_costs_t *c, uint_t y,
+                            uint_t x, uint_t span) {
+	for( ; span--; x++ )
+		if( !fb_is_binary(c, LEVEL(fb, x, y)) )
+			return 0;
+
+	return 1;
+}
+
+static int fb_col_is_binary(const monome_framebuffer_t *fb,
+                            const monome_led_costs_t *c, uint_t x,
+                            uint_t y, uint_t span) {
+	for( ; span--; y++ )
+		if( !fb_is_binary(c, LEVEL(fb, x, y)) )
+			return 0;
+
+	return 1;
+}
+
+static void fb_plan_quad(const monome_framebuffer_t *fb,
+                         const monome_led_costs_t *c, uint_t q,
+                         fb_plan_t *plan) {
+	uint_t r, i, start, span, cost, binary, changed_rows, changed_cols;
+	uint8_t level;
+
+	plan->x = (q % QUAD_COLS(fb)) << 3;
+	plan->y = (q / QUAD_COLS(fb)) << 3;
+	plan->how = ENCODE_NOTHING;
+	plan->cost = 0;
+
+	changed_rows = changed_cols = 0;
+	binary = 1;
+
+	for( r = 0; r < 8; r++ ) {
+		plan->diff[r] = 0;
+
+		for( i = 0; i < 8; i++ ) {
+			level = LEVEL(fb, plan->x + i, plan->y + r);
+
+			if( fb_differs(c, level, SHADOW(fb, plan->x + i, plan->y + r)) )
+				plan->diff[r] |= 1 << i;
+
+			binary &= fb_is_binary(c, level);
+		}
+
+		if( plan->diff[r] )
+			changed_rows |= 1 << r;
+
+		changed_cols |= plan->diff[r];
+	}
+
+	if( !changed_rows )
+		return;
+
+	/* one map message for the whole quadrant */
+	plan->how = ENCODE_MAP;
+	plan->cost = fb_msg_cost(c->map, c->level_map, binary);
+
+	/* one row message per changed row */
+	for( cost = 0, r = 0; r < 8; r++ ) {
+		if( !(changed_rows & (1 << r)) )
+			continue;
+
+		fb_line_span(fb, c, 1, plan->x, &start, &span);
+		cost = fb_add_cost(cost, fb_msg_cost(c->row, c->level_row,
+			fb_row_is_binary(fb, c, plan->y + r, start, span)));
+	}
+
+	if( cost < plan->cost ) {
+		plan->how = ENCODE_ROW;
+		plan->cost = cost;
+	}
+
+	/* one col message per changed column */
+	for( cost = 0, i = 0; i < 8; i++ ) {
+		if( !(changed_cols & (1 << i)) )
+			continue;
+
+		fb_line_span(fb, c, 0, plan->y, &start, &span);
+		cost = fb_add_cost(cost, fb_msg_cost(c->col, c->level_col,
+			fb_col_is_binary(fb, c, plan->x + i, start, span)));
+	}
+
+	if( cost < plan->cost ) {
+		plan->how = ENCODE_COL;
+		plan->cost = cost;
+	}
+
+	/* one set message per changed led */
+	for( cost = 0, r = 0; r < 8; r++ ) {
+		if( !plan->diff[r] )
+			continue;
+
+		for( i = 0; i < 8; i++ ) {
+			if( !(plan->diff[r] & (1 << i)) )
+				continue;
+
+			level = LEVEL(fb, plan->x + i, plan->y + r);
+			cost = fb_add_cost(cost, fb_msg_cost(c->set, c->level_set,
+				fb_is_binary(c, level)));
+		}
+	}
+
+	if( cost < plan->cost ) {
+		plan->how = ENCODE_SET;
+		plan->cost = cost;
+	}
+}
+
+static void fb_pack_bits(uint8_t *dst, const uint8_t *levels, uint_t count) {
+	reduce_levels_to_bitmasks(dst, levels, count);
+}
+
+static int fb_emit_set(monome_t *monome, const monome_led_costs_t *c,
+                       uint_t x, uint_t y) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint8_t level = LEVEL(fb, x, y);
+
+	SHADOW(fb, x, y) = level;
+
+	if( fb_use_binary(c->set, c->level_set, fb_is_binary(c, level)) )
+		return monome->led->set(monome, x, y, reduce_level_to_bit(level));
+
+	return monome->led_level->set(monome, x, y, level);
+}
+
+static int fb_emit_row(monome_t *monome, const monome_led_costs_t *c,
+                       uint_t x, uint_t y) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint8_t bits[FB_MAX_SIDE / 8];
+	uint_t start, span;
+
+	fb_line_span(fb, c, 1, x, &start, &span);
+	memcpy(&SHADOW(fb, start, y), &LEVEL(fb, start, y), span);
+
+	if( fb_use_binary(c->row, c->level_row,
+	                  fb_row_is_binary(fb, c, y, start, span)) ) {
+		fb_pack_bits(bits, &LEVEL(fb, start, y), span);
+		return monome->led->row(monome, start, y, span >> 3, bits);
+	}
+
+	return monome->led_level->row(monome, start, y, span, &LEVEL(fb, start, y));
+}
+
+static int fb_emit_col(monome_t *monome, const monome_led_costs_t *c,
+                       uint_t x, uint_t y) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint8_t bits[FB_MAX_SIDE / 8], levels[FB_MAX_SIDE];
+	uint_t i, start, span;
+
+	fb_line_span(fb, c, 0, y, &start, &span);
+
+	for( i = 0; i < span; i++ ) {
+		levels[i] = LEVEL(fb, x, start + i);
+		SHADOW(fb, x, start + i) = levels[i];
+	}
+
+	if( fb_use_binary(c->col, c->level_col,
+	                  fb_col_is_binary(fb, c, x, start, span)) ) {
+		fb_pack_bits(bits, levels, span);
+		return monome->led->col(monome, x, start, span >> 3, bits);
+	}
+
+	return monome->led_level->col(monome, x, start, span, levels);
+}
+
+static int fb_emit_map(monome_t *monome, const monome_led_costs_t *c,
+                       uint_t x, uint_t y) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint8_t bits[8], levels[64];
+	uint_t r, binary;
+
+	for( binary = 1, r = 0; r < 8; r++ ) {
+		memcpy(&levels[r * 8], &LEVEL(fb, x, y + r), 8);
+		memcpy(&SHADOW(fb, x, y + r), &LEVEL(fb, x, y + r), 8);
+		binary &= fb_row_is_binary(fb, c, y + r, x, 8);
+	}
+
+	if( fb_use_binary(c->map, c->level_map, binary) ) {
+		fb_pack_bits(bits, levels, 64);
+		return monome->led->map(monome, x, y, bits);
+	}
+
+	return monome->led_level->map(monome, x, y, levels);
+}
+
+static int fb_emit_plan(monome_t *monome, const monome_led_costs_t *c,
+                        const fb_plan_t *plan) {
+	uint_t r, i, cols;
+	int ret = 0;
+
+	switch( plan->how ) {
+	case ENCODE_NOTHING:
+		break;
+
+	case ENCODE_SET:
+		for( r = 0; r < 8; r++ )
+			for( i = 0; i < 8; i++ )
+				if( plan->diff[r] & (1 << i) )
+					ret |= fb_emit_set(monome, c, plan->x + i, plan->y + r);
+		break;
+
+	case ENCODE_ROW:
+		for( r = 0; r < 8; r++ )
+			if( plan->diff[r] )
+				ret |= fb_emit_row(monome, c, plan->x, plan->y + r);
+		break;
+
+	case ENCODE_COL:
+		for( cols = 0, r = 0; r < 8; r++ )
+			cols |= plan->diff[r];
+
+		for( i = 0; i < 8; i++ )
+			if( cols & (1 << i) )
+				ret |= fb_emit_col(monome, c, plan->x + i, plan->y);
+		break;
+
+	case ENCODE_MAP:
+		ret = fb_emit_map(monome, c, plan->x, plan->y);
+		break;
+	}
+
+	return (ret < 0) ? -1 : 0;
+}
+
+/* if every led in the frame has the same level, a single "all" message may
+   beat whatever the per-quadrant plans come up with. */
+static int fb_try_all(monome_t *monome, const monome_led_costs_t *c) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint_t i, q, cost, total, size;
+	uint8_t level;
+	fb_plan_t plan;
+
+	level = fb->levels[0];
+	size = fb->rows * fb->cols;
+
+	for( i = 1; i < size; i++ )
+		if( fb->levels[i] != level )
+			return 0;
+
+	cost = fb_msg_cost(c->all, c->level_all, fb_is_binary(c, level));
+	if( cost == COST_INFINITE )
+		return 0;
+
+	for( total = 0, q = 0; q < QUAD_COUNT(fb); q++ ) {
+		if( !(fb->dirty & (1ULL << q)) )
+			continue;
+
+		fb_plan_quad(fb, c, q, &plan);
+		total = fb_add_cost(total, plan.cost);
+	}
+
+	if( !total || cost > total )
+		return 0;
+
+	memset(fb->shadow, level, size);
+
+	if( fb_use_binary(c->all, c->level_all, fb_is_binary(c, level)) )
+		return (monome->led->all(monome, reduce_level_to_bit(level)) < 0)
+			? -1 : 1;
+
+	return (monome->led_level->all(monome, level) < 0) ? -1 : 1;
+}
+
+/* protocols that can encode a whole frame themselves keep their own picture
+   of the device and know better than the planner what's cheapest on the
+   wire, so they get the lot in one go. */
+static int fb_flush_frame(monome_t *monome) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint8_t bits[(FB_MAX_SIDE * FB_MAX_SIDE) / 8];
+	uint_t size = fb->rows * fb->cols;
+
+	fb_pack_bits(bits, fb->levels, size);
+	memcpy(fb->shadow, fb->levels, size);
+	fb->dirty = 0;
+
+	return (monome->led->frame(monome, bits) < 0) ? -1 : 0;
+}
+
+/* swap in the renderer's latest commit, if there is one we haven't seen,
+   and pass on the quadrants that changed since the one before */
+static void fb_take_committed(monome_framebuffer_t *fb) {
+	uintptr_t taken;
+	uint_t q, x, y, i;
+	size_t off;
+
+	if( !fb->front
+	    || !(m_atomic_load_ptr(&fb->committed) & FB_FRESH) )
+		return;
+
+	taken = m_atomic_exchange_ptr(&fb->committed, (uintptr_t) fb->front);
+	fb->front = (uint8_t *) (taken & ~FB_FRESH);
+
+	for( q = 0; q < QUAD_COUNT(fb); q++ ) {
+		x = (q % QUAD_COLS(fb)) * 8;
+		y = (q / QUAD_COLS(fb)) * 8;
+
+		for( i = 0; i < 8; i++ ) {
+			off = ((y + i) * fb->cols) + x;
+
+			if( memcmp(&fb->levels[off], &fb->front[off], 8) )
+				break;
+		}
+
+		if( i == 8 )
+			continue;
+
+		for( i = 0; i < 8; i++ ) {
+			off = ((y + i) * fb->cols) + x;
+			memcpy(&fb->levels[off], &fb->front[off], 8);
+		}
+
+		fb->dirty |= 1ULL << q;
+	}
+}
+
+/**
+ * framebuffer
+ */
+
+uint8_t *monome_framebuffer_get(monome_t *monome) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint_t rows, cols;
+
+	if( fb )
+		return fb->levels;
+
+	rows = monome_get_rows(monome);
+	cols = monome_get_cols(monome);
+
+	if( !rows || !cols || ((rows | cols) & 7)
+		|| rows > FB_MAX_SIDE || cols > FB_MAX_SIDE )
+		return NULL;
+
+	if( !(fb = m_calloc(1, sizeof(monome_framebuffer_t))) )
+		return NULL;
+
+	fb->levels = m_calloc(rows * cols, 1);
+	fb->shadow = m_malloc(rows * cols);
+
+	if( !fb->levels || !fb->shadow ) {
+		m_free(fb->levels);
+		m_free(fb->shadow);
+		m_free(fb);
+		return NULL;
+	}
+
+	monome->fb = fb;
+	monome_framebuffer_reset(monome);
+
+	return fb->levels;
+}
+
+void monome_framebuffer_mark_dirty(monome_t *monome, uint_t x, uint_t y,
+                                   uint_t w, uint_t h) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint_t qx, qy;
+
+	if( !fb || x >= fb->cols || y >= fb->rows || !w || !h )
+		return;
+
+	if( w > fb->cols - x )
+		w = fb->cols - x;
+
+	if( h > fb->rows - y )
+		h = fb->rows - y;
+
+	for( qy = y >> 3; qy <= (y + h - 1) >> 3; qy++ )
+		for( qx = x >> 3; qx <= (x + w - 1) >> 3; qx++ )
+			fb->dirty |= 1ULL << ((qy * QUAD_COLS(fb)) + qx);
+}
+
+int monome_framebuffer_flush(monome_t *monome) {
+	monome_framebuffer_t *fb = monome->fb;
+	monome_led_costs_t c;
+	fb_plan_t plan;
+	uint_t q;
+	int ret;
+
+	if( !fb )
+		return 0;
+
+	fb_take_committed(fb);
+
+	if( !fb->dirty )
+		return 0;
+
+	if( monome->led_level && monome->led_level->frame ) {
+		ret = monome->led_level->frame(monome, fb->levels, fb->dirty);
+
+		memcpy(fb->shadow, fb->levels, fb->rows * fb->cols);
+		fb->dirty = 0;
+		return (ret < 0) ? -1 : 0;
+	}
+
+	fb_oriented_costs(monome, &c);
+
+	if( (c.flags & LED_MONOCHROME) && monome->led && monome->led->frame )
+		return fb_flush_frame(monome);
+
+	if( (ret = fb_try_all(monome, &c)) ) {
+		fb->dirty = 0;
+		return (ret < 0) ? -1 : 0;
+	}
+
+	/* quadrants are planned one at a time, against a shadow that already
+	   includes whatever earlier quadrants sent. on devices where a row
+	   message covers the whole grid, one quadrant's rows can take care of
+	   its neighbour too. */
+	for( q = 0; q < QUAD_COUNT(fb); q++ ) {
+		if( !(fb->dirty & (1ULL << q)) )
+			continue;
+
+		fb_plan_quad(fb, &c, q, &plan);
+		ret |= fb_emit_plan(monome, &c, &plan);
+	}
+
+	fb->dirty = 0;
+	return ret;
+}
+
+/* called when the rotation changes. the device has to be redrawn from
+   scratch, and if rows and columns traded places the old contents no longer
+   make sense so we clear them. */
+void monome_framebuffer_reset(monome_t *monome) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint_t rows, cols, i;
+
+	if( !fb )
+		return;
+
+	rows = monome_get_rows(monome);
+	cols = monome_get_cols(monome);
+
+	if( rows != fb->rows || cols != fb->cols ) {
+		memset(fb->levels, 0, rows * cols);
+
+		/* nothing stops a renderer drawing into its page meanwhile, which
+		   is why the rotation mustn't change while pages are in use */
+		for( i = 0; i < 3; i++ )
+			if( fb->pages[i] )
+				memset(fb->pages[i], 0, rows * cols);
+
+		fb->rows = rows;
+		fb->cols = cols;
+	}
+
+	memset(fb->shadow, FB_UNKNOWN, rows * cols);
+	monome_framebuffer_mark_dirty(monome, 0, 0, cols, rows);
+}
+
+/* moves levels around inside the framebuffer. the flush diffs against the
+   shadow like always, so after a scroll only what actually changed on the
+   grid goes out. */
+
+/* clips a rectangle to the grid, returns 0 if nothing is left of it */
+static int fb_clip(const monome_framebuffer_t *fb, uint_t x, uint_t y,
+                   uint_t *w, uint_t *h) {
+	if( x >= fb->cols || y >= fb->rows || !*w || !*h )
+		return 0;
+
+	if( *w > fb->cols - x )
+		*w = fb->cols - x;
+
+	if( *h > fb->rows - y )
+		*h = fb->rows - y;
+
+	return 1;
+}
+
+static void fb_move(monome_framebuffer_t *fb, uint_t sx, uint_t sy,
+                    uint_t w, uint_t h, uint_t dx, uint_t dy) {
+	uint_t i;
+
+	/* rows go in whichever order leaves an overlapping source intact,
+	   memmove sees to overlap within a row */
+	if( dy > sy )
+		for( i = h; i--; )
+			memmove(&LEVEL(fb, dx, dy + i), &LEVEL(fb, sx, sy + i), w);
+	else
+		for( i = 0; i < h; i++ )
+			memmove(&LEVEL(fb, dx, dy + i), &LEVEL(fb, sx, sy + i), w);
+}
+
+static void fb_fill(monome_framebuffer_t *fb, uint_t x, uint_t y, uint_t w,
+                    uint_t h, uint8_t level) {
+	for( ; h--; y++ )
+		memset(&LEVEL(fb, x, y), level, w);
+}
+
+int monome_framebuffer_copy(monome_t *monome, uint_t sx, uint_t sy,
+                            uint_t w, uint_t h, uint_t dx, uint_t dy) {
+	monome_framebuffer_t *fb;
+
+	if( !monome_framebuffer_get(monome) )
+		return -1;
+
+	fb = monome->fb;
+
+	if( !fb_clip(fb, sx, sy, &w, &h) || !fb_clip(fb, dx, dy, &w, &h) )
+		return 0;
+
+	fb_move(fb, sx, sy, w, h, dx, dy);
+	monome_framebuffer_mark_dirty(monome, dx, dy, w, h);
+
+	return 0;
+}
+
+/* scrolls the contents of a rectangle by (dx, dy), filling in what's
+   uncovered. whatever is pushed past the edge of the rectangle is lost. */
+int monome_framebuffer_shift(monome_t *monome, uint_t x, uint_t y, uint_t w,
+                             uint_t h, int dx, int dy, uint_t fill) {
+	monome_framebuffer_t *fb;
+	uint_t adx, ady;
+
+	if( !monome_framebuffer_get(monome) )
+		return -1;
+
+	fb = monome->fb;
+	fill &= 0xF;
+
+	if( !fb_clip(fb, x, y, &w, &h) )
+		return 0;
+
+	adx = (dx < 0) ? -dx : dx;
+	ady = (dy < 0) ? -dy : dy;
+
+	if( adx >= w || ady >= h ) {
+		fb_fill(fb, x, y, w, h, fill);
+		goto out;
+	}
+
+	fb_move(fb,
+	        x + ((dx < 0) ? adx : 0), y + ((dy < 0) ? ady : 0),
+	        w - adx, h - ady,
+	        x + ((dx > 0) ? adx : 0), y + ((dy > 0) ? ady : 0));
+
+	if( dy )
+		fb_fill(fb, x, (dy > 0) ? y : y + h - ady, w, ady, fill);
+
+	if( dx )
+		fb_fill(fb, (dx > 0) ? x : x + w - adx, y, adx, h, fill);
+
+out:
+	monome_framebuffer_mark_dirty(monome, x, y, w, h);
+	return 0;
+}
+
+/* draws a w * h block of levels (rows stride apart) in at (x, y) */
+int monome_framebuffer_blit(monome_t *monome, uint_t x, uint_t y, uint_t w,
+                            uint_t h, const uint8_t *src, size_t stride,
+                            monome_blend_t blend) {
+	monome_framebuffer_t *fb;
+	uint_t i;
+
+	if( !monome_framebuffer_get(monome) )
+		return -1;
+
+	fb = monome->fb;
+
+	if( !fb_clip(fb, x, y, &w, &h) )
+		return 0;
+
+	for( i = 0; i < h; i++ )
+		blend_levels(&LEVEL(fb, x, y + i), &src[i * stride], w, blend);
+
+	monome_framebuffer_mark_dirty(monome, x, y, w, h);
+	return 0;
+}
+
+/* hands the renderer a page holding what it last committed. nothing else
+   touches that page until it's committed, so it can be drawn into at
+   leisure while the flusher works from another thread. */
+uint8_t *monome_framebuffer_begin(monome_t *monome) {
+	monome_framebuffer_t *fb;
+	uint_t i;
+
+	if( !monome_framebuffer_get(monome) )
+		return NULL;
+
+	fb = monome->fb;
+
+	if( !fb->back ) {
+		for( i = 0; i < 3; i++ ) {
+			if( !(fb->pages[i] = m_malloc(fb->rows * fb->cols)) ) {
+				while( i-- )
+					m_free(fb->pages[i]);
+
+				return NULL;
+			}
+
+			memcpy(fb->pages[i], fb->levels, fb->rows * fb->cols);
+		}
+
+		fb->back = fb->pages[0];
+		fb->last = fb->pages[1];
+		fb->front = fb->pages[2];
+		m_atomic_exchange_ptr(&fb->committed, (uintptr_t) fb->pages[1]);
+	}
+
+	/* the flusher may be reading last too, but never writes to it */
+	memcpy(fb->back, fb->last, fb->rows * fb->cols);
+	return fb->back;
+}
+
+/* publishes the page from monome_framebuffer_begin() with a single swap,
+   and takes back whichever page the flusher doesn't need any more */
+int monome_framebuffer_commit(monome_t *monome) {
+	monome_framebuffer_t *fb = monome->fb;
+	uintptr_t old;
+
+	if( !fb || !fb->back )
+		return -1;
+
+	old = m_atomic_exchange_ptr(&fb->committed,
+	                            (uintptr_t) fb->back | FB_FRESH);
+
+	fb->last = fb->back;
+	fb->back = (uint8_t *) (old & ~FB_FRESH);
+
+	return 0;
+}
+
+void monome_framebuffer_free(monome_t *monome) {
+	monome_framebuffer_t *fb = monome->fb;
+	uint_t i;
+
+	if( !fb )
+		return;
+
+	for( i = 0; i < 3; i++ )
+		m_free(fb->pages[i]);
+
+	m_free(fb->levels);
+	m_free(fb->shadow);
+	m_free(fb);
+
+	monome->fb = NULL;
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "keystate.h"
+
+/* there's only ever one writer (whoever is reading events), so the seqlock
+   is just a counter that's odd while an update is in progress. readers
+   retry until they see the same even count on both sides of their copy. */
+
+void keystate_set(monome_keystate_t *ks, uint_t x, uint_t y, int down) {
+	uint16_t row, bit;
+	uint32_t seq;
+
+	if( x >= 16 || y >= MONOME_KEYSTATE_ROWS )
+		return;
+
+	bit = 1 << x;
+	row = m_atomic_load_16(&ks->rows[y]);
+
+	if( !!(row & bit) == !!down )
+		return;
+
+	seq = m_atomic_load_32(&ks->seq);
+	m_atomic_store_32(&ks->seq, seq + 1);
+	m_atomic_fence();
+
+	m_atomic_store_16(&ks->rows[y], row ^ bit);
+	m_atomic_store_32(&ks->count,
+	                  m_atomic_load_32(&ks->count) + ((down) ? 1 : -1));
+
+	m_atomic_store_32(&ks->seq, seq + 2);
+}
+
+void monome_keystate_update(monome_t *monome, uint_t x, uint_t y, int down) {
+	keystate_set(&monome->keys, x, y, down);
+}
+
+int monome_keystate_get(monome_t *monome, uint_t x, uint_t y) {
+	if( x >= 16 || y >= MONOME_KEYSTATE_ROWS )
+		return 0;
+
+	return !!(m_atomic_load_16(&monome->keys.rows[y]) & (1 << x));
+}
+
+uint_t monome_keystate_count(monome_t *monome) {
+	return m_atomic_load_32(&monome->keys.count);
+}
+
+uint_t keystate_read(monome_keystate_t *ks, uint16_t *rows) {
+	uint32_t seq, count;
+	uint_t i;
+
+	do {
+		while( (seq = m_atomic_load_32(&ks->seq)) & 1 )
+			;
+
+		for( i = 0; i < MONOME_KEYSTATE_ROWS; i++ )
+			rows[i] = m_atomic_load_16(&ks->rows[i]);
+		count = m_atomic_load_32(&ks->count);
+	} while( seq != m_atomic_load_32(&ks->seq) );
+
+	return count;
+}
+
+uint_t monome_keystate_snapshot(monome_t *monome, uint16_t *rows) {
+	return keystate_read(&monome->keys, rows);
+}
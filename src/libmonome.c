@@ -30,6 +30,14 @@
 #include "internal.h"
 #include "platform.h"
 #include "rotation.h"
+#include "framebuffer.h"
+#include "compositor.h"
+#include "ringframe.h"
+#include "keystate.h"
+#include "tilt.h"
+#include "capture.h"
+#include "schedule.h"
+#include "shm.h"
 #include "devices.h"
 
 #ifndef LIBSUFFIX
@@ -74,7 +82,24 @@ monome_t *monome_open(const char *dev, ...) {
 	m = NULL;
 
 	/* first let's figure out which protocol to use */
-	if( !strstr(dev, "://") ) {
+	if( monome_replay_is_dev(dev) ) {
+		/* a capture taken from a tty, which records the serial of the device
+		   it came from */
+
+		if( !(serial = monome_replay_get_serial(dev)) )
+			return NULL;
+
+		if( (m = map_serial_to_device(serial)) )
+			proto = m->proto;
+		else
+			goto err_init;
+	} else if( !strncmp(dev, "tile:", 5) ) {
+		/* a virtual grid made of other devices, see proto/tile.c */
+		proto = "tile";
+	} else if( !strncmp(dev, "shm:", 4) ) {
+		/* a device shared by another process, see shm.c */
+		proto = "shm";
+	} else if( !strstr(dev, "://") ) {
 		/* assume that the device is a tty...let's probe and see what device
 		   we're dealing with */
 
@@ -127,6 +152,12 @@ void monome_close(monome_t *monome) {
 	if( monome->device )
 		m_free((char *) monome->device);
 
+	monome_shm_free(monome);
+	monome_compositor_free(monome);
+	monome_framebuffer_free(monome);
+	monome_ring_shadow_free(monome);
+	monome_scheduler_free(monome);
+
 	monome->close(monome);
 	monome_platform_free(monome);
 }
@@ -139,6 +170,10 @@ const char *monome_get_devpath(monome_t *monome) {
 	return monome->device;
 }
 
+void monome_get_io_stats(monome_t *monome, monome_io_stats_t *stats) {
+	*stats = monome->io;
+}
+
 const char *monome_get_friendly_name(monome_t *monome) {
 	return monome->friendly;
 }
@@ -166,7 +201,12 @@ monome_rotate_t monome_get_rotation(monome_t *monome) {
 }
 
 void monome_set_rotation(monome_t *monome, monome_rotate_t rotation) {
+	if( monome->fixed_rotation )
+		return;
+
 	monome->rotation = rotation & 3;
+	monome_framebuffer_reset(monome);
+	monome_compositor_reset(monome);
 }
 
 int monome_register_handler(monome_t *monome, monome_event_type_t event_type,
@@ -189,9 +229,14 @@ int monome_unregister_handler(monome_t *monome,
 }
 
 int monome_event_next(monome_t *monome, monome_event_t *e) {
+	int status;
+
 	e->monome = monome;
 
-	return monome->next_event(monome, e);
+	if( (status = monome->next_event(monome, e)) )
+		return status;
+
+	return monome_tilt_filter_next(monome, e);
 }
 
 int monome_event_handle_next(monome_t *monome) {
@@ -203,19 +248,40 @@ int monome_event_handle_next(monome_t *monome) {
 	if (status <= 0)
 		return status;
 
+	/* an event with no handler is still consumed, and there may be more
+	   behind it, so that counts too */
 	handler = &monome->handlers[e.event_type];
 
-	if( !handler->cb )
-		return 0;
+	if( handler->cb )
+		handler->cb(&e, handler->data);
 
-	handler->cb(&e, handler->data);
 	return 1;
 }
 
+int monome_event_pending(monome_t *monome) {
+	if( monome->pending && monome->pending(monome) )
+		return 1;
+
+	return !monome_tilt_filter_timeout(monome);
+}
+
 int monome_get_fd(monome_t *monome) {
 	return monome->fd;
 }
 
+int monome_key_get(monome_t *monome, uint_t x, uint_t y) {
+	ROTATE_COORDS(monome, x, y);
+	return monome_keystate_get(monome, x, y);
+}
+
+uint_t monome_key_count(monome_t *monome) {
+	return monome_keystate_count(monome);
+}
+
+uint_t monome_key_snapshot(monome_t *monome, uint16_t rows[16]) {
+	return monome_keystate_snapshot(monome, rows);
+}
+
 #define REQUIRE(capability) if (!monome->capability) return -1
 
 int monome_led_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
@@ -296,26 +362,169 @@ int monome_event_get_grid(const monome_event_t *e, unsigned int *out_x, unsigned
 	return 0;
 }
 
+uint8_t *monome_led_frame_get(monome_t *monome) {
+	if( !monome->led_costs )
+		return NULL;
+
+	return monome_framebuffer_get(monome);
+}
+
+int monome_led_frame_set(monome_t *monome, uint_t x, uint_t y, uint_t level) {
+	uint8_t *levels;
+
+	REQUIRE(led_costs);
+
+	if( !(levels = monome_framebuffer_get(monome)) )
+		return -1;
+
+	if( x >= monome_get_cols(monome) || y >= monome_get_rows(monome) )
+		return -1;
+
+	levels[(y * monome_get_cols(monome)) + x] = level & 0xF;
+	monome_framebuffer_mark_dirty(monome, x, y, 1, 1);
+
+	return 0;
+}
+
+int monome_led_frame_dirty(monome_t *monome, uint_t x, uint_t y,
+                           uint_t width, uint_t height) {
+	REQUIRE(led_costs);
+
+	monome_framebuffer_mark_dirty(monome, x, y, width, height);
+	return 0;
+}
+
+int monome_led_frame_copy(monome_t *monome, uint_t src_x, uint_t src_y,
+                          uint_t width, uint_t height, uint_t dst_x,
+                          uint_t dst_y) {
+	REQUIRE(led_costs);
+	return monome_framebuffer_copy(monome, src_x, src_y, width, height,
+	                               dst_x, dst_y);
+}
+
+int monome_led_frame_shift(monome_t *monome, uint_t x, uint_t y,
+                           uint_t width, uint_t height, int dx, int dy,
+                           uint_t fill) {
+	REQUIRE(led_costs);
+	return monome_framebuffer_shift(monome, x, y, width, height, dx, dy,
+	                                fill);
+}
+
+int monome_led_frame_blit(monome_t *monome, uint_t x, uint_t y, uint_t width,
+                          uint_t height, const uint8_t *levels, size_t stride,
+                          monome_blend_t blend) {
+	REQUIRE(led_costs);
+	return monome_framebuffer_blit(monome, x, y, width, height, levels,
+	                               stride, blend);
+}
+
+uint8_t *monome_led_frame_begin(monome_t *monome) {
+	if( !monome->led_costs )
+		return NULL;
+
+	return monome_framebuffer_begin(monome);
+}
+
+int monome_led_frame_commit(monome_t *monome) {
+	REQUIRE(led_costs);
+	return monome_framebuffer_commit(monome);
+}
+
+int monome_led_frame_flush(monome_t *monome) {
+	int ret;
+
+	REQUIRE(led_costs);
+
+	monome_compositor_compose(monome);
+	ret = monome_framebuffer_flush(monome);
+
+	if( monome->output && monome->output->flush(monome) < 0 )
+		return -1;
+
+	return ret;
+}
+
+uint8_t *monome_led_layer_get(monome_t *monome, uint_t layer) {
+	if( !monome->led_costs )
+		return NULL;
+
+	return monome_compositor_layer_get(monome, layer);
+}
+
+int monome_led_layer_blend(monome_t *monome, uint_t layer,
+                           monome_blend_t blend) {
+	REQUIRE(led_costs);
+	return monome_compositor_set_blend(monome, layer, blend);
+}
+
+int monome_led_layer_dirty(monome_t *monome, uint_t x, uint_t y,
+                           uint_t width, uint_t height) {
+	REQUIRE(led_costs);
+
+	monome_compositor_mark_dirty(monome, x, y, width, height);
+	return 0;
+}
+
 int monome_led_ring_set(monome_t *monome, uint_t ring, uint_t led,
                         uint_t level) {
+	int ret;
+
 	REQUIRE(led_ring);
-	return monome->led_ring->set(monome, ring, led, level);
+
+	if( (ret = monome->led_ring->set(monome, ring, led, level)) < 0 )
+		monome_ring_shadow_forget(monome, ring);
+	else
+		monome_ring_shadow_set(monome, ring, led, level);
+
+	return ret;
 }
 
 int monome_led_ring_all(monome_t *monome, uint_t ring, uint_t level) {
+	int ret;
+
 	REQUIRE(led_ring);
-	return monome->led_ring->all(monome, ring, level);
+
+	if( (ret = monome->led_ring->all(monome, ring, level)) < 0 )
+		monome_ring_shadow_forget(monome, ring);
+	else
+		monome_ring_shadow_all(monome, ring, level);
+
+	return ret;
 }
 
 int monome_led_ring_map(monome_t *monome, uint_t ring, const uint8_t *levels) {
+	int ret;
+
 	REQUIRE(led_ring);
-	return monome->led_ring->map(monome, ring, levels);
+
+	if( (ret = monome->led_ring->map(monome, ring, levels)) < 0 )
+		monome_ring_shadow_forget(monome, ring);
+	else
+		monome_ring_shadow_map(monome, ring, levels);
+
+	return ret;
 }
 
 int monome_led_ring_range(monome_t *monome, uint_t ring, uint_t start,
                           uint_t end, uint_t level) {
+	int ret;
+
 	REQUIRE(led_ring);
-	return monome->led_ring->range(monome, ring, start, end, level);
+
+	if( (ret = monome->led_ring->range(monome, ring, start, end, level)) < 0 )
+		monome_ring_shadow_forget(monome, ring);
+	else
+		monome_ring_shadow_range(monome, ring, start, end, level);
+
+	return ret;
+}
+
+int monome_led_ring_frame(monome_t *monome, uint_t ring,
+                          const uint8_t *levels) {
+	REQUIRE(led_ring);
+	REQUIRE(ring_costs);
+
+	return monome_ring_frame(monome, ring, levels);
 }
 
 int monome_led_ring_intensity(monome_t *monome, uint_t brightness) {
@@ -323,6 +532,16 @@ int monome_led_ring_intensity(monome_t *monome, uint_t brightness) {
 	return monome->led_ring->intensity(monome, brightness);
 }
 
+int monome_set_encoder_coalescing(monome_t *monome, uint_t enable,
+                                  uint_t window_msec) {
+	REQUIRE(led_ring);
+
+	monome->coalesce.enabled = !!enable;
+	monome->coalesce.window  = window_msec;
+
+	return 0;
+}
+
 int monome_tilt_enable(monome_t *monome, uint_t sensor) {
 	REQUIRE(tilt);
 	return monome->tilt->enable(monome, sensor);
@@ -332,3 +551,61 @@ int monome_tilt_disable(monome_t *monome, uint_t sensor) {
 	REQUIRE(tilt);
 	return monome->tilt->disable(monome, sensor);
 }
+
+int monome_tilt_set_filter(monome_t *monome, uint_t sensor, uint_t max_rate,
+                           uint_t threshold) {
+	REQUIRE(tilt);
+
+	if( sensor >= MONOME_TILT_SENSORS )
+		return -1;
+
+	monome_tilt_filter_set(monome, sensor, max_rate, threshold);
+	return 0;
+}
+
+int monome_set_output_batching(monome_t *monome, uint_t enable) {
+	REQUIRE(output);
+	return monome->output->batch(monome, !!enable);
+}
+
+int monome_flush(monome_t *monome) {
+	REQUIRE(output);
+	return monome->output->flush(monome);
+}
+
+uint64_t monome_time_usec(void) {
+	return m_time_usec();
+}
+
+#define PROTO_SCHEDULES(monome) \
+	((monome)->output && (monome)->output->schedule_begin)
+
+int monome_schedule_begin(monome_t *monome, uint64_t when) {
+	if( PROTO_SCHEDULES(monome) )
+		return monome->output->schedule_begin(monome, when);
+
+	return monome_scheduler_begin(monome, when);
+}
+
+int monome_schedule_end(monome_t *monome) {
+	if( PROTO_SCHEDULES(monome) )
+		return monome->output->schedule_end(monome);
+
+	return monome_scheduler_end(monome);
+}
+
+#undef PROTO_SCHEDULES
+
+int monome_schedule_run(monome_t *monome) {
+	int timeout, tilt;
+
+	timeout = monome_scheduler_run(monome);
+
+	/* a tilt event held back by the rate limit wants a wakeup as well */
+	tilt = monome_tilt_filter_timeout(monome);
+
+	if( tilt >= 0 && (timeout < 0 || tilt < timeout) )
+		timeout = tilt;
+
+	return timeout;
+}
@@ -14,14 +14,111 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "internal.h"
+#include "rotation.h"
+#include "monobright.h"
+
+/**
+ * private
+ */
+
+/* bit i of the result is set when levels[i] is bright enough to turn
+   the led on. */
+
+static uint8_t reduce_8(const uint8_t *levels) {
+	uint64_t x = 0;
+	int i;
+
+	/* assembled by hand so levels[0] lands in the low byte whatever the
+	   host's byte order. compilers turn this into a single load. */
+	for( i = 7; i >= 0; i-- )
+		x = (x << 8) | levels[i];
+
+	/* a level is over 7 iff any of its top five bits are set. fold those
+	   down into the high bit of each byte... */
+	x &= 0xF8F8F8F8F8F8F8F8ULL;
+	x = (((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | x)
+		& 0x8080808080808080ULL;
+
+	/* ...then gather the eight high bits into the top byte. */
+	return (uint8_t) ((x * 0x0002040810204081ULL) >> 56);
+}
+
+#if defined(__SSE2__)
+#define HAVE_REDUCE_16
+
+static uint_t reduce_16(const uint8_t *levels) {
+	__m128i v = _mm_loadu_si128((const __m128i *) levels);
+
+	/* sse2 has no unsigned byte compare, but a byte is <= 7 exactly when
+	   min(byte, 7) is the byte itself. */
+	v = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(7)), v);
+	return ~_mm_movemask_epi8(v) & 0xFFFF;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_REDUCE_16
+
+static uint_t reduce_16(const uint8_t *levels) {
+	static const uint8_t weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128,
+		1, 2, 4, 8, 16, 32, 64, 128
+	};
+
+	uint8x16_t on;
+	uint8x8_t sum;
+
+	/* neon has no movemask. weight each lane by its bit and narrow with
+	   pairwise adds until each half has been summed into a byte. */
+	on  = vcgtq_u8(vld1q_u8(levels), vdupq_n_u8(7));
+	on  = vandq_u8(on, vld1q_u8(weights));
+	sum = vpadd_u8(vget_low_u8(on), vget_high_u8(on));
+	sum = vpadd_u8(sum, sum);
+	sum = vpadd_u8(sum, sum);
+
+	return vget_lane_u8(sum, 0) | (vget_lane_u8(sum, 1) << 8);
+}
+#endif
+
+/**
+ * public
+ */
 
 uint8_t reduce_levels_to_bitmask(const uint8_t *levels) {
 	/* levels is expected to be uint8_t[8] */
-	uint_t i;
-	uint8_t byte = 0;
-	for (i = 0; i < 8; i++) {
-		byte |= ((levels[i] > 7) & 0x01) << i;
+	return reduce_8(levels);
+}
+
+void reduce_levels_to_bitmasks(uint8_t *masks, const uint8_t *levels,
+                               size_t count) {
+	size_t i = 0;
+
+#ifdef HAVE_REDUCE_16
+	uint_t m;
+
+	for( ; i + 16 <= count; i += 16 ) {
+		m = reduce_16(&levels[i]);
+
+		masks[i >> 3]       = m & 0xFF;
+		masks[(i >> 3) + 1] = m >> 8;
 	}
-	return byte;
+#endif
+
+	for( ; i + 8 <= count; i += 8 )
+		masks[i >> 3] = reduce_8(&levels[i]);
+}
+
+void reduce_quadrant_to_bitmask(monome_t *monome, uint8_t *masks,
+                                const uint8_t *levels) {
+	reduce_levels_to_bitmasks(masks, levels, 64);
+
+	/* rotating the packed quadrant is a handful of operations on a 64-bit
+	   word, where rotating the levels first would shuffle 64 bytes. */
+	ROTSPEC(monome).map_cb(monome, masks);
 }
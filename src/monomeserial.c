@@ -21,7 +21,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <poll.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <glob.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
 
 #include <getopt.h>
 #include <lo/lo.h>
@@ -43,12 +51,143 @@
 #define DPRINTF(...) ((void) 0)
 #endif
 
+#define DEFAULT_STATS_INTERVAL  10
+
+/* how often to look for an unplugged device, and how far that's backed off
+   while something else keeps turning up where we look */
+#define RECONNECT_INTERVAL_USEC 100000
+#define RECONNECT_MAX_BACKOFF   6
+
+typedef struct ms_device ms_device;
+
+/* incoming osc messages, counted by path */
+typedef enum {
+	MS_PATH_LED,
+	MS_PATH_CLEAR,
+	MS_PATH_FRAME,
+	MS_PATH_LED_ROW,
+	MS_PATH_LED_COL,
+	MS_PATH_INTENSITY,
+	MS_PATH_SYS,
+
+	MS_PATH_MAX
+} ms_path_t;
+
+static const char *path_names[MS_PATH_MAX] = {
+	[MS_PATH_LED]       = "led",
+	[MS_PATH_CLEAR]     = "clear",
+	[MS_PATH_FRAME]     = "frame",
+	[MS_PATH_LED_ROW]   = "led_row",
+	[MS_PATH_LED_COL]   = "led_col",
+	[MS_PATH_INTENSITY] = "intensity",
+	[MS_PATH_SYS]       = "sys"
+};
+
+static const char *event_names[MONOME_EVENT_MAX] = {
+	[MONOME_BUTTON_UP]        = "button_up",
+	[MONOME_BUTTON_DOWN]      = "button_down",
+	[MONOME_ENCODER_DELTA]    = "encoder_delta",
+	[MONOME_ENCODER_KEY_UP]   = "encoder_key_up",
+	[MONOME_ENCODER_KEY_DOWN] = "encoder_key_down",
+	[MONOME_TILT]             = "tilt"
+};
+
+typedef struct {
+	uint64_t messages[MS_PATH_MAX];
+
+	/* messages that were malformed or went to a path we don't know */
+	uint64_t dropped;
+
+	/* led messages drawn into the framebuffer, and how many flushes it took
+	   to get them out. the difference is what coalescing saved. */
+	uint64_t led_updates;
+	uint64_t flushes;
+
+	uint64_t events[MONOME_EVENT_MAX];
+
+	/* io from earlier connections to the device */
+	monome_io_stats_t io_closed;
+} ms_stats;
+
+/* where a wakeup rate is measured from. every consumer of the rate keeps
+   its own, so asking for it in one place doesn't reset it for another. */
 typedef struct {
+	uint64_t wakeups;
+	uint64_t time;
+} ms_rate;
+
+/* what an fd in the main loop belongs to */
+typedef struct {
+	enum {
+		MS_SOURCE_MONOME,
+		MS_SOURCE_OSC
+	} type;
+
+	ms_device *dev;
+} ms_source;
+
+struct ms_device {
 	monome_t *monome;
 	lo_address outgoing;
 	lo_server server;
 
+	char *devpath;
 	char *lo_prefix;
+	char sport[8], aport[8];
+
+	ms_source monome_source;
+	ms_source osc_source;
+
+	/* NULL if the device can't do framebuffered output */
+	uint8_t *frame;
+	uint_t rows, cols;
+
+	/* series and 40h devices clear the rest of a 16-led line when sent a
+	   one-byte row or column, so we do the same in the framebuffer */
+	int fill_line;
+
+	int frame_pending;
+	uint64_t last_flush;
+
+	/* while the device is unplugged, led messages are drawn in here so
+	   they can be replayed once it comes back */
+	uint8_t *saved;
+	int intensity;
+
+	char *serial;
+	uint64_t next_reconnect;
+
+	/* reconnect passes in a row that only found other devices */
+	int mismatches;
+
+	ms_stats stats;
+
+	/* for /sys/stats, which this device's application asks for */
+	ms_rate stats_rate;
+};
+
+typedef struct {
+	ms_device *devices;
+	int ndevices;
+
+	monome_rotate_t rotate;
+
+	/* minimum usec between led flushes, 0 to flush after every drain */
+	uint64_t frame_interval;
+
+	/* times the main loop has woken up, since start_time */
+	uint64_t wakeups;
+	uint64_t start_time;
+
+	/* periodic stats dump, if asked for */
+	FILE *stats_file;
+	uint64_t stats_interval;
+	uint64_t next_dump;
+	ms_rate dump_rate;
+
+#if defined(__linux__)
+	int epfd;
+#endif
 } ms_state;
 
 ms_state state;
@@ -59,72 +198,336 @@ static void lo_error(int num, const char *error_msg, const char *path) {
 	fflush(stdout);
 }
 
+/**
+ * led state
+ *
+ * incoming led messages are drawn into the device's framebuffer and only
+ * the net difference is written out, once the socket has been drained (or
+ * less often, if the refresh rate is capped). clients that send a stream of
+ * single /led messages otherwise saturate the serial link.
+ */
+
+static void frame_put(ms_device *dev, uint_t x, uint_t y, int on) {
+	if( x >= dev->cols || y >= dev->rows )
+		return;
+
+	dev->frame[(y * dev->cols) + x] = (on) ? 15 : 0;
+}
+
+static void frame_changed(ms_device *dev, uint_t x, uint_t y,
+                          uint_t w, uint_t h) {
+	dev->stats.led_updates++;
+
+	/* unplugged, we're drawing into the saved copy */
+	if( !dev->monome )
+		return;
+
+	monome_led_frame_dirty(dev->monome, x, y, w, h);
+	dev->frame_pending = 1;
+}
+
+static void frame_flush(ms_device *dev, uint64_t now) {
+	if( !dev->frame_pending )
+		return;
+
+	if( state.frame_interval
+		&& now - dev->last_flush < state.frame_interval )
+		return;
+
+	monome_led_frame_flush(dev->monome);
+
+	dev->frame_pending = 0;
+	dev->last_flush = now;
+	dev->stats.flushes++;
+}
+
+/* liblo takes anything but 0 to mean the message wasn't handled and tries
+   the next method, which would end up counting it as dropped. the led
+   functions return how many bytes they wrote, so squash that. */
+static int handled(int ret) {
+	return (ret < 0) ? -1 : 0;
+}
+
 static int osc_led_handler(const char *path, const char *types,
 						   lo_arg **argv, int argc,
 						   lo_message data, void *user_data) {
-	monome_t *monome = user_data;
+	ms_device *dev = user_data;
+
+	dev->stats.messages[MS_PATH_LED]++;
 
 	if( (argc != 3 || strcmp("iii", types)) ||
 		(argv[0]->i > 15 || argv[0]->i < 0) ||
 		(argv[1]->i > 15 || argv[1]->i < 0) ||
-		(argv[2]->i > 1  || argv[2]->i < 0) )
+		(argv[2]->i > 1  || argv[2]->i < 0) ||
+		(!dev->frame && !dev->monome) )
 		return -1;
 
-	return monome_led_set(monome, argv[0]->i, argv[1]->i, argv[2]->i);
+	if( !dev->frame )
+		return handled(monome_led_set(dev->monome,
+		                              argv[0]->i, argv[1]->i, argv[2]->i));
+
+	frame_put(dev, argv[0]->i, argv[1]->i, argv[2]->i);
+	frame_changed(dev, argv[0]->i, argv[1]->i, 1, 1);
+	return 0;
 }
 
 static int osc_led_all_handler(const char *path, const char *types,
 							 lo_arg **argv, int argc,
 							 lo_message data, void *user_data) {
-	monome_t *monome = user_data;
+	ms_device *dev = user_data;
 	int mode = (argc) ? argv[0]->i : 0;
 
-	return monome_led_all(monome, mode);
+	dev->stats.messages[MS_PATH_CLEAR]++;
+
+	if( !dev->frame && !dev->monome )
+		return -1;
+
+	if( !dev->frame )
+		return handled(monome_led_all(dev->monome, mode));
+
+	memset(dev->frame, (mode) ? 15 : 0, dev->rows * dev->cols);
+	frame_changed(dev, 0, 0, dev->cols, dev->rows);
+	return 0;
 }
 
 static int osc_led_col_row_handler(const char *path, const char *types,
 								   lo_arg **argv, int argc,
 								   lo_message data, void *user_data) {
-	monome_t *monome = user_data;
+	ms_device *dev = user_data;
 	uint8_t buf[2] = {argv[1]->i};
+	int col = !!strstr(path, "led_col");
+	uint_t i, len, line = argv[0]->i;
+
+	dev->stats.messages[(col) ? MS_PATH_LED_COL : MS_PATH_LED_ROW]++;
 
 	if( argc == 3 )
 		buf[1] = argv[2]->i;
 
-	if( strstr(path, "led_col") )
-		return monome_led_col(monome, argv[0]->i, 0, argc - 1, buf);
+	if( !dev->frame && !dev->monome )
+		return -1;
+
+	if( !dev->frame ) {
+		if( col )
+			return handled(monome_led_col(dev->monome, line, 0,
+			                              argc - 1, buf));
+		else
+			return handled(monome_led_row(dev->monome, 0, line,
+			                              argc - 1, buf));
+	}
+
+	/* a one-byte message clears the rest of a 16-led line on the devices
+	   that always did that, and only touches 8 leds everywhere else */
+	if( dev->fill_line ) {
+		len = (col) ? dev->rows : dev->cols;
+		if( len > 16 )
+			len = 16;
+	} else {
+		len = (col) ? dev->rows : dev->cols;
+		if( len > (argc - 1) * 8 )
+			len = (argc - 1) * 8;
+	}
+
+	for( i = 0; i < len; i++ ) {
+		if( col )
+			frame_put(dev, line, i, buf[i >> 3] & (1 << (i & 7)));
+		else
+			frame_put(dev, i, line, buf[i >> 3] & (1 << (i & 7)));
+	}
+
+	if( col )
+		frame_changed(dev, line, 0, 1, len);
 	else
-		return monome_led_row(monome, 0, argv[0]->i, argc - 1, buf);
+		frame_changed(dev, 0, line, len, 1);
+
+	return 0;
 }
 
 static int osc_led_map_handler(const char *path, const char *types,
                                lo_arg **argv, int argc,
                                lo_message data, void *user_data) {
-	monome_t *monome = user_data;
+	ms_device *dev = user_data;
+	uint_t x_off = 0, y_off = 0;
 	uint8_t buf[8];
-	uint i;
+	uint i, j;
+
+	dev->stats.messages[MS_PATH_FRAME]++;
 
 	for( i = 0; i < 8; i++ )
 		buf[i] = argv[i + (argc - 8)]->i;
 
 	switch( argc ) {
 	case 8:
-		return monome_led_map(monome, 0, 0, buf);
+		break;
 
 	case 10:
-		return monome_led_map(monome, argv[0]->i, argv[1]->i, buf);
+		x_off = argv[0]->i;
+		y_off = argv[1]->i;
+		break;
+
+	default:
+		return -1;
 	}
 
-	return -1;
+	if( !dev->frame && !dev->monome )
+		return -1;
+
+	if( !dev->frame )
+		return handled(monome_led_map(dev->monome, x_off, y_off, buf));
+
+	/* maps always cover a whole quadrant */
+	x_off &= ~7;
+	y_off &= ~7;
+
+	for( i = 0; i < 8; i++ )
+		for( j = 0; j < 8; j++ )
+			frame_put(dev, x_off + j, y_off + i, buf[i] & (1 << j));
+
+	frame_changed(dev, x_off, y_off, 8, 8);
+	return 0;
 }
 
 static int osc_intensity_handler(const char *path, const char *types,
 								 lo_arg **argv, int argc,
 								 lo_message data, void *user_data) {
-	monome_t *monome = user_data;
+	ms_device *dev = user_data;
 	int intensity = (argc) ? argv[0]->i : 0xF;
 
-	return monome_led_intensity(monome, intensity);
+	dev->stats.messages[MS_PATH_INTENSITY]++;
+	dev->intensity = intensity;
+
+	if( !dev->monome )
+		return 0;
+
+	return handled(monome_led_intensity(dev->monome, intensity));
+}
+
+/**
+ * stats
+ */
+
+/* wakeups per second since the consumer last asked (or since startup, the
+   first time) */
+static double wakeup_rate(ms_rate *since, uint64_t now) {
+	double rate = 0;
+
+	if( !since->time )
+		since->time = state.start_time;
+
+	if( now > since->time )
+		rate = (state.wakeups - since->wakeups) * 1000000.0
+			/ (now - since->time);
+
+	since->wakeups = state.wakeups;
+	since->time = now;
+
+	return rate;
+}
+
+static void stats_get_io(ms_device *dev, monome_io_stats_t *io) {
+	*io = dev->stats.io_closed;
+
+	if( dev->monome ) {
+		monome_io_stats_t cur;
+
+		monome_get_io_stats(dev->monome, &cur);
+
+		io->writes        += cur.writes;
+		io->bytes_written += cur.bytes_written;
+		io->reads         += cur.reads;
+		io->bytes_read    += cur.bytes_read;
+	}
+}
+
+static void stats_dump(FILE *f, uint64_t now) {
+	monome_io_stats_t io;
+	ms_stats *st;
+	ms_device *dev;
+	int i, j;
+
+	fprintf(f, "monomeserial: %" PRIu64 " wakeups (%.1f/s)\n",
+	        state.wakeups, wakeup_rate(&state.dump_rate, now));
+
+	for( i = 0; i < state.ndevices; i++ ) {
+		dev = &state.devices[i];
+		st = &dev->stats;
+
+		stats_get_io(dev, &io);
+
+		fprintf(f, "  %s (/%s)%s\n    messages:", dev->devpath,
+		        dev->lo_prefix, (dev->monome) ? "" : ", disconnected");
+
+		for( j = 0; j < MS_PATH_MAX; j++ )
+			fprintf(f, " %s %" PRIu64, path_names[j], st->messages[j]);
+
+		fprintf(f, ", dropped %" PRIu64 "\n", st->dropped);
+
+		fprintf(f, "    leds: %" PRIu64 " updates, %" PRIu64 " flushes, "
+		        "%" PRIu64 " coalesced\n", st->led_updates, st->flushes,
+		        st->led_updates - st->flushes);
+
+		fprintf(f, "    device: %" PRIu64 " writes (%" PRIu64 " bytes), "
+		        "%" PRIu64 " reads (%" PRIu64 " bytes)\n",
+		        io.writes, io.bytes_written, io.reads, io.bytes_read);
+
+		fprintf(f, "    events:");
+
+		for( j = 0; j < MONOME_EVENT_MAX; j++ )
+			fprintf(f, " %s %" PRIu64, event_names[j], st->events[j]);
+
+		fprintf(f, "\n");
+	}
+
+	fflush(f);
+}
+
+/* answers to the application port, like everything else we send */
+static int osc_stats_handler(const char *path, const char *types,
+                             lo_arg **argv, int argc,
+                             lo_message data, void *user_data) {
+	ms_device *dev = user_data;
+	ms_stats *st = &dev->stats;
+	lo_timetag now = LO_TT_IMMEDIATE;
+	monome_io_stats_t io;
+	int i;
+
+	st->messages[MS_PATH_SYS]++;
+	stats_get_io(dev, &io);
+
+	for( i = 0; i < MS_PATH_MAX; i++ )
+		lo_send_from(dev->outgoing, dev->server, now, "/sys/stats/messages",
+		             "sh", path_names[i], (int64_t) st->messages[i]);
+
+	lo_send_from(dev->outgoing, dev->server, now, "/sys/stats/dropped",
+	             "h", (int64_t) st->dropped);
+
+	lo_send_from(dev->outgoing, dev->server, now, "/sys/stats/leds",
+	             "hhh", (int64_t) st->led_updates, (int64_t) st->flushes,
+	             (int64_t) (st->led_updates - st->flushes));
+
+	lo_send_from(dev->outgoing, dev->server, now, "/sys/stats/device",
+	             "hhhh", (int64_t) io.writes, (int64_t) io.bytes_written,
+	             (int64_t) io.reads, (int64_t) io.bytes_read);
+
+	for( i = 0; i < MONOME_EVENT_MAX; i++ )
+		lo_send_from(dev->outgoing, dev->server, now, "/sys/stats/events",
+		             "sh", event_names[i], (int64_t) st->events[i]);
+
+	lo_send_from(dev->outgoing, dev->server, now, "/sys/stats/wakeups",
+	             "hf", (int64_t) state.wakeups,
+	             (float) wakeup_rate(&dev->stats_rate,
+	                                 monome_time_usec()));
+
+	return 0;
+}
+
+/* registered last, liblo only gets here for messages nothing else took */
+static int osc_dropped_handler(const char *path, const char *types,
+                               lo_arg **argv, int argc,
+                               lo_message data, void *user_data) {
+	ms_device *dev = user_data;
+
+	dev->stats.dropped++;
+	return 0;
 }
 
 #define ASPRINTF_OR_BAIL(...) do { \
@@ -132,43 +535,48 @@ static int osc_intensity_handler(const char *path, const char *types,
 		return;                    \
 	} while (0);
 
-static void register_osc_methods(char *prefix, monome_t *monome) {
-	lo_server srv = (lo_server)state.server;
+static void register_osc_methods(ms_device *dev) {
+	lo_server srv = dev->server;
+	char *prefix = dev->lo_prefix;
 	char *cmd_buf;
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/led", prefix);
-	lo_server_add_method(srv, cmd_buf, "iii", osc_led_handler, monome);
+	lo_server_add_method(srv, cmd_buf, "iii", osc_led_handler, dev);
 	m_free(cmd_buf);
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/clear", prefix);
-	lo_server_add_method(srv, cmd_buf, "", osc_led_all_handler, monome);
-	lo_server_add_method(srv, cmd_buf, "i", osc_led_all_handler, monome);
+	lo_server_add_method(srv, cmd_buf, "", osc_led_all_handler, dev);
+	lo_server_add_method(srv, cmd_buf, "i", osc_led_all_handler, dev);
 	m_free(cmd_buf);
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/frame", prefix);
-	lo_server_add_method(srv, cmd_buf, "iiiiiiii", osc_led_map_handler, monome);
+	lo_server_add_method(srv, cmd_buf, "iiiiiiii", osc_led_map_handler, dev);
 	lo_server_add_method(srv, cmd_buf, "iiiiiiiiii",
-						 osc_led_map_handler, monome);
+						 osc_led_map_handler, dev);
 	m_free(cmd_buf);
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/led_row", prefix);
-	lo_server_add_method(srv, cmd_buf, "ii", osc_led_col_row_handler, monome);
-	lo_server_add_method(srv, cmd_buf, "iii", osc_led_col_row_handler, monome);
+	lo_server_add_method(srv, cmd_buf, "ii", osc_led_col_row_handler, dev);
+	lo_server_add_method(srv, cmd_buf, "iii", osc_led_col_row_handler, dev);
 	m_free(cmd_buf);
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/led_col", prefix);
-	lo_server_add_method(srv, cmd_buf, "ii", osc_led_col_row_handler, monome);
-	lo_server_add_method(srv, cmd_buf, "iii", osc_led_col_row_handler, monome);
+	lo_server_add_method(srv, cmd_buf, "ii", osc_led_col_row_handler, dev);
+	lo_server_add_method(srv, cmd_buf, "iii", osc_led_col_row_handler, dev);
 	m_free(cmd_buf);
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/intensity", prefix);
-	lo_server_add_method(srv, cmd_buf, "", osc_intensity_handler, monome);
-	lo_server_add_method(srv, cmd_buf, "i", osc_intensity_handler, monome);
+	lo_server_add_method(srv, cmd_buf, "", osc_intensity_handler, dev);
+	lo_server_add_method(srv, cmd_buf, "i", osc_intensity_handler, dev);
 	m_free(cmd_buf);
+
+	lo_server_add_method(srv, "/sys/stats", "", osc_stats_handler, dev);
+	lo_server_add_method(srv, NULL, NULL, osc_dropped_handler, dev);
 }
 
-static void unregister_osc_methods(char *prefix) {
-	lo_server srv = (lo_server)state.server;
+static void unregister_osc_methods(ms_device *dev) {
+	lo_server srv = dev->server;
+	char *prefix = dev->lo_prefix;
 	char *cmd_buf;
 
 	ASPRINTF_OR_BAIL(&cmd_buf, "/%s/clear", prefix);
@@ -200,14 +608,17 @@ static void unregister_osc_methods(char *prefix) {
 	lo_server_del_method(srv, cmd_buf, "iiiiiiiiii");
 	m_free(cmd_buf);
 
+	lo_server_del_method(srv, "/sys/stats", "");
+	lo_server_del_method(srv, NULL, NULL);
+
 }
 
 static void monome_handle_press(const monome_event_t *e, void *data) {
+	ms_device *dev = data;
 	char *cmd;
-	char *prefix = data;
 
-	ASPRINTF_OR_BAIL(&cmd, "/%s/press", prefix);
-	lo_send_from(state.outgoing, (lo_server)state.server, LO_TT_IMMEDIATE, cmd, "iii",
+	ASPRINTF_OR_BAIL(&cmd, "/%s/press", dev->lo_prefix);
+	lo_send_from(dev->outgoing, dev->server, LO_TT_IMMEDIATE, cmd, "iii",
 				 e->grid.x, e->grid.y, e->event_type);
 	m_free(cmd);
 }
@@ -220,7 +631,10 @@ static void usage(const char *app) {
 		"\n"
 		"  -h, --help			display this information\n"
 		"\n"
-		"  -d, --device <device>		the monome serial device\n"
+		"  -d, --device <device>[,<prefix>[,<server port>[,<app port>]]]\n"
+		"				a monome serial device. give more than once\n"
+		"				to serve several devices. ports default to\n"
+		"				the next ones up for each extra device.\n"
 
 		/*
 		 * protocol cannot currently be explicitly specified.
@@ -237,7 +651,14 @@ static void usage(const char *app) {
 		"\n"
 		"  -r, --rotation <degrees>	rotate the monome. "
 			"degrees can only be one of 0, 90, 180, or 270.\n"
-		"\n", app);
+		"  -f, --frame-rate <fps>	update the leds at most this many times\n"
+		"				a second (default: as fast as messages\n"
+		"				come in)\n"
+		"\n"
+		"  -S, --stats <file>		write statistics to <file> (\"-\" for\n"
+		"				stderr) every so often\n"
+		"  -i, --stats-interval <secs>	how often, in seconds (default: %d)\n"
+		"\n", app, DEFAULT_STATS_INTERVAL);
 }
 
 static int is_numstr(const char *s) {
@@ -250,74 +671,516 @@ static int is_numstr(const char *s) {
 	return 1;
 }
 
-/* on OSX, poll() does not work with devices (i.e. ttys). */
+/**
+ * devices
+ */
 
-#ifndef HAVE_BROKEN_POLL
-static int main_loop() {
-	struct pollfd fds[2];
+/* "device[,prefix[,server port[,app port]]]". anything left out comes from
+   the global options, with the ports counting up from them by index. */
+static int device_parse_spec(ms_device *dev, char *spec, int index,
+                             const char *prefix, const char *sport,
+                             const char *aport) {
+	char *field[4] = {NULL};
+	int i;
+
+	for( i = 0; i < 4 && spec; i++ ) {
+		field[i] = spec;
+
+		if( (spec = strchr(spec, ',')) )
+			*spec++ = '\0';
+	}
+
+	if( (field[2] && !is_numstr(field[2]))
+		|| (field[3] && !is_numstr(field[3])) ) {
+		printf("warning: bad port in device \"%s\"\n", field[0]);
+		return -1;
+	}
+
+	dev->devpath   = field[0];
+	dev->lo_prefix = m_strdup((field[1] && *field[1]) ? field[1] : prefix);
+
+	snprintf(dev->sport, sizeof(dev->sport), "%d",
+	         (field[2]) ? atoi(field[2]) : atoi(sport) + index);
+	snprintf(dev->aport, sizeof(dev->aport), "%d",
+	         (field[3]) ? atoi(field[3]) : atoi(aport) + index);
+
+	dev->monome_source = (ms_source) {MS_SOURCE_MONOME, dev};
+	dev->osc_source    = (ms_source) {MS_SOURCE_OSC, dev};
+
+	return 0;
+}
+
+#if defined(__linux__)
+static int epoll_add(int epfd, int fd, ms_source *src) {
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = src
+	};
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+#endif
+
+/* sets up a freshly opened monome. if it's coming back after being
+   unplugged, whatever was drawn in the meantime is put back on it. */
+static void device_attach(ms_device *dev, monome_t *monome) {
+	uint_t rows, cols;
+
+	dev->monome = monome;
+	monome_set_rotation(monome, state.rotate);
+
+	rows = monome_get_rows(monome);
+	cols = monome_get_cols(monome);
+
+	/* a new framebuffer has every led marked dirty and nothing known about
+	   the device, so the first flush draws the whole grid in as few
+	   messages as the protocol allows (which for a blank one is a clear). */
+	if( (dev->frame = monome_led_frame_get(monome)) ) {
+		if( dev->saved && rows == dev->rows && cols == dev->cols )
+			memcpy(dev->frame, dev->saved, rows * cols);
+
+		monome_led_frame_flush(monome);
+		dev->last_flush = monome_time_usec();
+	} else
+		monome_led_all(monome, 0);
+
+	dev->rows = rows;
+	dev->cols = cols;
+	dev->mismatches = 0;
+	dev->fill_line = !strcmp(monome_get_proto(monome), "series")
+	                 || !strcmp(monome_get_proto(monome), "40h");
+	dev->frame_pending = 0;
+
+	m_free(dev->saved);
+	dev->saved = NULL;
+
+	if( dev->intensity >= 0 )
+		monome_led_intensity(monome, dev->intensity);
+
+#if defined(__linux__)
+	/* not there yet for the devices opened at startup */
+	if( state.epfd >= 0 )
+		epoll_add(state.epfd, monome_get_fd(monome), &dev->monome_source);
+#endif
+}
+
+static int device_open(ms_device *dev, const char *ahost) {
+	monome_t *monome;
+
+	if( !(monome = monome_open(dev->devpath)) ) {
+		printf("failed to open %s\n", dev->devpath);
+		return -1;
+	}
+
+	if( !(dev->server = lo_server_new(dev->sport, lo_error)) ) {
+		monome_close(monome);
+		return -1;
+	}
+
+	dev->outgoing = lo_address_new(ahost, dev->aport);
+
+	register_osc_methods(dev);
+
+	dev->serial = m_strdup(monome_get_serial(monome));
+	dev->intensity = -1;
+
+	device_attach(dev, monome);
+
+	printf("initialized device %s (%s) at %s, which is %dx%d using proto %s\n",
+		   monome_get_serial(dev->monome), monome_get_friendly_name(dev->monome),
+		   monome_get_devpath(dev->monome),
+		   monome_get_rows(dev->monome), monome_get_cols(dev->monome),
+		   monome_get_proto(dev->monome));
+	printf("running with prefix /%s on port %s (application port %s)\n\n",
+		   dev->lo_prefix, dev->sport, dev->aport);
+
+	return 0;
+}
+
+static void device_close(ms_device *dev) {
+	if( dev->monome ) {
+		monome_close(dev->monome);
+		dev->monome = NULL;
+		dev->frame = NULL;
+	}
+
+	if( dev->server ) {
+		unregister_osc_methods(dev);
+		lo_server_free(dev->server);
+		lo_address_free(dev->outgoing);
+
+		dev->server = NULL;
+		dev->outgoing = NULL;
+	}
+
+	m_free(dev->saved);
+	m_free(dev->serial);
+	m_free(dev->lo_prefix);
+
+	dev->saved = NULL;
+	dev->serial = NULL;
+	dev->lo_prefix = NULL;
+}
+
+/* the osc server keeps running while the device is gone, so applications
+   can carry on drawing and nothing is lost when it comes back. */
+static void device_disconnected(ms_device *dev) {
+	size_t size = dev->rows * dev->cols;
+
+	printf("%s disconnected, waiting for it to come back.\n",
+	       monome_get_devpath(dev->monome));
+
+	if( size && (dev->saved = m_malloc(size)) ) {
+		if( dev->frame )
+			memcpy(dev->saved, dev->frame, size);
+		else
+			memset(dev->saved, 0, size);
+	}
+
+	stats_get_io(dev, &dev->stats.io_closed);
+
+	/* closing the fd takes it out of the epoll set as well */
+	monome_close(dev->monome);
+
+	dev->monome = NULL;
+	dev->frame = dev->saved;
+	dev->frame_pending = 0;
+	dev->next_reconnect = monome_time_usec() + RECONNECT_INTERVAL_USEC;
+}
+
+static int device_is_open_at(const char *path) {
+	int i;
+
+	for( i = 0; i < state.ndevices; i++ )
+		if( state.devices[i].monome
+			&& !strcmp(monome_get_devpath(state.devices[i].monome), path) )
+			return 1;
+
+	return 0;
+}
+
+static uint64_t reconnect_interval(ms_device *dev) {
+	int shift = dev->mismatches;
+
+	if( shift > RECONNECT_MAX_BACKOFF )
+		shift = RECONNECT_MAX_BACKOFF;
+
+	return RECONNECT_INTERVAL_USEC << shift;
+}
+
+/* returns 0 if the device is back, 1 if something else is at the path, and
+   -1 if nothing usable is. */
+static int device_try(ms_device *dev, const char *path) {
+	monome_t *monome;
+	char *serial;
+	int match;
+
+	if( access(path, R_OK | W_OK) || device_is_open_at(path) )
+		return -1;
+
+	/* check the serial the system has for the port before opening it. some
+	   other program may have the device that's there now, and opening it
+	   would send that device queries and block us waiting for replies. */
+	if( !(serial = monome_platform_get_dev_serial(path)) )
+		return -1;
+
+	match = dev->serial && !strcmp(serial, dev->serial);
+	m_free(serial);
+
+	if( !match )
+		return 1;
+
+	if( !(monome = monome_open(path)) )
+		return -1;
+
+	device_attach(dev, monome);
+
+	printf("%s is back at %s.\n", dev->serial, path);
+	fflush(stdout);
+
+	return 0;
+}
+
+/* the device can come back under a different name. on linux, udev keeps
+   links named after the usb serial, so check those first. */
+static void device_reconnect(ms_device *dev) {
+	int mismatch = 0, ret;
+#if defined(__linux__)
+	glob_t links;
+	size_t i;
+
+	if( dev->serial && !glob("/dev/serial/by-id/*", 0, NULL, &links) ) {
+		for( i = 0; i < links.gl_pathc; i++ ) {
+			if( !strstr(links.gl_pathv[i], dev->serial) )
+				continue;
+
+			if( !(ret = device_try(dev, links.gl_pathv[i])) )
+				break;
+
+			mismatch |= ret > 0;
+		}
+
+		globfree(&links);
+
+		if( dev->monome )
+			return;
+	}
+#endif
+
+	if( !(ret = device_try(dev, dev->devpath)) )
+		return;
+
+	/* something else is sitting where the device was, so look less often
+	   until it goes away */
+	if( mismatch || ret > 0 )
+		dev->mismatches++;
+	else
+		dev->mismatches = 0;
+}
+
+/* read everything that's waiting rather than one event per wakeup */
+static void device_read(ms_device *dev) {
+	monome_event_t e;
+
+	while( monome_event_next(dev->monome, &e) > 0 ) {
+		if( e.event_type < MONOME_EVENT_MAX )
+			dev->stats.events[e.event_type]++;
+
+		switch( e.event_type ) {
+		case MONOME_BUTTON_DOWN:
+		case MONOME_BUTTON_UP:
+			monome_handle_press(&e, dev);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+static void osc_read(ms_device *dev) {
+	while( lo_server_recv_noblock(dev->server, 0) > 0 )
+		;
+
+	if( dev->frame )
+		frame_flush(dev, monome_time_usec());
+}
+
+/* liblo holds on to bundles timetagged for the future and only dispatches
+   them from lo_server_recv*() once they're due, so don't sleep past that,
+   nor past a flush that was held back by the refresh rate cap, nor past the
+   next look for an unplugged device. */
+static int loop_timeout_msec(void) {
+	double delay, wait, min = -1;
+	uint64_t now = monome_time_usec(), since;
+	ms_device *dev;
+	int i;
+
+	for( i = 0; i < state.ndevices; i++ ) {
+		dev = &state.devices[i];
+		delay = lo_server_next_event_delay(dev->server);
+
+		if( !dev->monome ) {
+			wait = (dev->next_reconnect > now)
+				? (dev->next_reconnect - now) / 1000000.0 : 0;
+
+			if( wait < delay )
+				delay = wait;
+		} else if( dev->frame_pending ) {
+			since = now - dev->last_flush;
+			wait = (since >= state.frame_interval)
+				? 0 : (state.frame_interval - since) / 1000000.0;
+
+			if( wait < delay )
+				delay = wait;
+		}
+
+		if( min < 0 || delay < min )
+			min = delay;
+	}
+
+	if( state.stats_file ) {
+		delay = (state.next_dump > now)
+			? (state.next_dump - now) / 1000000.0 : 0;
+
+		if( min < 0 || delay < min )
+			min = delay;
+	}
+
+	/* round up, so we don't wake just short of the deadline */
+	return (min < 0) ? -1 : (int) ((min * 1000) + 0.999);
+}
+
+static void run_timers(void) {
+	uint64_t now = monome_time_usec();
+	ms_device *dev;
+	int i;
+
+	for( i = 0; i < state.ndevices; i++ ) {
+		dev = &state.devices[i];
+
+		if( !dev->monome && now >= dev->next_reconnect ) {
+			device_reconnect(dev);
+			dev->next_reconnect = now + reconnect_interval(dev);
+		}
+
+		if( lo_server_next_event_delay(dev->server) <= 0 )
+			osc_read(dev);
+		else if( dev->frame )
+			frame_flush(dev, now);
+	}
+
+	if( state.stats_file && now >= state.next_dump ) {
+		stats_dump(state.stats_file, now);
+		state.next_dump = now + state.stats_interval;
+	}
+}
+
+static void source_ready(ms_source *src, int hangup) {
+	ms_device *dev = src->dev;
+
+	switch( src->type ) {
+	case MS_SOURCE_MONOME:
+		/* went away earlier in this same batch */
+		if( !dev->monome )
+			break;
+
+		if( hangup )
+			device_disconnected(dev);
+		else
+			device_read(dev);
+
+		break;
+
+	case MS_SOURCE_OSC:
+		osc_read(dev);
+		break;
+	}
+}
+
+/**
+ * main loop
+ */
 
-	fds[0].fd = monome_get_fd(state.monome);
-	fds[1].fd = lo_server_get_socket_fd((lo_server)state.server);
+#if defined(__linux__)
+#define MS_MAX_EPOLL_EVENTS 32
 
-	fds[0].events = fds[1].events = 
-		POLLIN;
+static int main_loop() {
+	struct epoll_event events[MS_MAX_EPOLL_EVENTS];
+	ms_device *dev;
+	int epfd, i, n;
+
+	if( (state.epfd = epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ) {
+		perror("monomeserial: epoll_create1");
+		return 1;
+	}
 
-	do {
-		/* block until either the monome or liblo have data */
-		poll(fds, 2, -1);
+	for( i = 0; i < state.ndevices; i++ ) {
+		dev = &state.devices[i];
 
-		/* is the monome still connected? */
-		if( fds[0].revents & (POLLHUP | POLLERR) )
+		if( epoll_add(epfd, monome_get_fd(dev->monome), &dev->monome_source)
+			|| epoll_add(epfd, lo_server_get_socket_fd(dev->server),
+			             &dev->osc_source) ) {
+			perror("monomeserial: epoll_ctl");
+			close(epfd);
+			state.epfd = -1;
 			return 1;
+		}
+	}
 
-		/* is there data available for reading from the monome? */
-		if( fds[0].revents & POLLIN )
-			monome_event_handle_next(state.monome);
+	for( ;; ) {
+		n = epoll_wait(epfd, events, MS_MAX_EPOLL_EVENTS, loop_timeout_msec());
+		state.wakeups++;
 
-		/* how about from OSC? */
-		if( fds[1].revents & POLLIN )
-			lo_server_recv_noblock((lo_server)state.server, 0);
-	} while( 1 );
+		if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+
+			perror("monomeserial: epoll_wait");
+			break;
+		}
+
+		for( i = 0; i < n; i++ )
+			source_ready(events[i].data.ptr,
+			             events[i].events & (EPOLLHUP | EPOLLERR));
+
+		run_timers();
+	}
+
+	close(epfd);
+	state.epfd = -1;
+
+	return 1;
 }
 #else
+/* on OSX, poll() does not work with devices (i.e. ttys). */
 static int main_loop() {
 	fd_set rfds, efds;
-	int maxfd, mfd, lofd;
+	int maxfd, fd, timeout, i;
+	struct timeval tv;
+	ms_device *dev;
 
-	mfd  = monome_get_fd(state.monome);
-	lofd = lo_server_get_socket_fd((lo_server)state.server);
-	maxfd = ((lofd > mfd) ? lofd : mfd) + 1;
-
-	do {
+	for( ;; ) {
 		FD_ZERO(&rfds);
-		FD_SET(mfd, &rfds);
-		FD_SET(lofd, &rfds);
-
 		FD_ZERO(&efds);
-		FD_SET(mfd, &efds);
+		maxfd = -1;
 
-		/* block until either the monome or liblo have data */
-		select(maxfd, &rfds, NULL, &efds, NULL);
+		for( i = 0; i < state.ndevices; i++ ) {
+			dev = &state.devices[i];
 
-		/* is the monome still connected? */
-		if( FD_ISSET(mfd, &efds) )
-			return 1;
+			if( dev->monome ) {
+				fd = monome_get_fd(dev->monome);
+				FD_SET(fd, &rfds);
+				FD_SET(fd, &efds);
+				maxfd = (fd > maxfd) ? fd : maxfd;
+			}
+
+			fd = lo_server_get_socket_fd(dev->server);
+			FD_SET(fd, &rfds);
+			maxfd = (fd > maxfd) ? fd : maxfd;
+		}
+
+		timeout = loop_timeout_msec();
+		tv.tv_sec  = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+
+		i = select(maxfd + 1, &rfds, NULL, &efds, (timeout < 0) ? NULL : &tv);
+		state.wakeups++;
+
+		if( i < 0 ) {
+			if( errno == EINTR )
+				continue;
+
+			perror("monomeserial: select");
+			break;
+		}
+
+		for( i = 0; i < state.ndevices; i++ ) {
+			dev = &state.devices[i];
+
+			if( dev->monome ) {
+				fd = monome_get_fd(dev->monome);
+
+				if( FD_ISSET(fd, &efds) || FD_ISSET(fd, &rfds) )
+					source_ready(&dev->monome_source, FD_ISSET(fd, &efds));
+			}
 
-		/* is there data available for reading from the monome? */
-		if( FD_ISSET(mfd, &rfds) )
-			monome_event_handle_next(state.monome);
+			if( FD_ISSET(lo_server_get_socket_fd(dev->server), &rfds) )
+				source_ready(&dev->osc_source, 0);
+		}
 
-		/* how about from OSC? */
-		if( FD_ISSET(lofd, &rfds) )
-			lo_server_recv_noblock((lo_server)state.server, 0);
-	} while( 1 );
+		run_timers();
+	}
+
+	return 1;
 }
 #endif
 
 int main(int argc, char *argv[]) {
-	char *device, *sport, *aport, *ahost;
-	monome_rotate_t rotate = MONOME_ROTATE_0;
-	int c, i;
+	char *sport, *aport, *ahost, *prefix;
+	char **specs, *default_spec[1];
+	char *stats_path = NULL;
+	int c, i, nspecs, stats_interval = DEFAULT_STATS_INTERVAL;
 
 	struct option arguments[] = {
 		{"help",             no_argument,       0, 'h'},
@@ -328,15 +1191,30 @@ int main(int argc, char *argv[]) {
 		{"application-port", required_argument, 0, 'a'},
 		{"application-host", required_argument, 0, 'o'},
 
-		{"rotation",         required_argument, 0, 'r'}
+		{"rotation",         required_argument, 0, 'r'},
+		{"frame-rate",       required_argument, 0, 'f'},
+
+		{"stats",            required_argument, 0, 'S'},
+		{"stats-interval",   required_argument, 0, 'i'},
+
+		{0, 0, 0, 0}
 	};
 
-	device = DEFAULT_MONOME_DEVICE;
 	sport  = DEFAULT_OSC_SERVER_PORT;
 	aport  = DEFAULT_OSC_APP_PORT;
 	ahost  = DEFAULT_OSC_APP_HOST;
 
-	while( (c = getopt_long(argc, argv, "hd:s:a:o:r:",
+#if defined(__linux__)
+	state.epfd = -1;
+#endif
+
+	/* there can't be more devices than arguments */
+	if( !(specs = m_calloc(argc, sizeof(char *))) )
+		return EXIT_FAILURE;
+
+	nspecs = 0;
+
+	while( (c = getopt_long(argc, argv, "hd:s:a:o:r:f:S:i:",
 							arguments, &i)) > 0 ) {
 		switch( c ) {
 		case 'h':
@@ -344,7 +1222,7 @@ int main(int argc, char *argv[]) {
 			return 1;
 
 		case 'd':
-			device = optarg;
+			specs[nspecs++] = optarg;
 			break;
 
 		case 's':
@@ -371,60 +1249,96 @@ int main(int argc, char *argv[]) {
 
 		case 'r':
 			switch(*optarg) {
-			case 'l': case '0': rotate = MONOME_ROTATE_0;   break;
-			case 't': case '9': rotate = MONOME_ROTATE_90;  break;
-			case 'r': case '1': rotate = MONOME_ROTATE_180; break;
-			case 'b': case '2': rotate = MONOME_ROTATE_270; break;
+			case 'l': case '0': state.rotate = MONOME_ROTATE_0;   break;
+			case 't': case '9': state.rotate = MONOME_ROTATE_90;  break;
+			case 'r': case '1': state.rotate = MONOME_ROTATE_180; break;
+			case 'b': case '2': state.rotate = MONOME_ROTATE_270; break;
 			}
 			break;
+
+		case 'f':
+			if( is_numstr(optarg) && atoi(optarg) > 0 )
+				state.frame_interval = 1000000 / atoi(optarg);
+			else
+				printf("warning: \"%s\" is not a valid frame rate.\n",
+					   optarg);
+
+			break;
+
+		case 'S':
+			stats_path = optarg;
+			break;
+
+		case 'i':
+			if( is_numstr(optarg) && atoi(optarg) > 0 )
+				stats_interval = atoi(optarg);
+			else
+				printf("warning: \"%s\" is not a valid stats interval.\n",
+					   optarg);
+
+			break;
 		}
 	}
 
 	if( optind == argc )
-		state.lo_prefix = m_strdup(DEFAULT_OSC_PREFIX);
+		prefix = DEFAULT_OSC_PREFIX;
 	else
-		state.lo_prefix = m_strdup(argv[optind]);
+		prefix = argv[optind];
 
-	if( !(state.monome = monome_open(device)) ) {
-		printf("failed to open %s\n", device);
-		return EXIT_FAILURE;
+	if( !nspecs ) {
+		default_spec[0] = m_strdup(DEFAULT_MONOME_DEVICE);
+		m_free(specs);
+		specs  = default_spec;
+		nspecs = 1;
 	}
 
-	if( !(state.server = lo_server_new(sport, lo_error)) )
+	if( !(state.devices = m_calloc(nspecs, sizeof(ms_device))) )
 		return EXIT_FAILURE;
 
-	state.outgoing = lo_address_new(ahost, aport);
+	printf("monomeserial version %s, yay!\n\n", VERSION);
 
-	monome_register_handler(state.monome, MONOME_BUTTON_DOWN,
-							monome_handle_press, state.lo_prefix);
-	monome_register_handler(state.monome, MONOME_BUTTON_UP,
-							monome_handle_press, state.lo_prefix);
+	for( i = 0; i < nspecs; i++ ) {
+		if( device_parse_spec(&state.devices[i], specs[i], i, prefix,
+		                      sport, aport)
+			|| device_open(&state.devices[i], ahost) ) {
+			state.ndevices = i + 1;
+			goto out;
+		}
+	}
 
-	register_osc_methods(state.lo_prefix, state.monome);
+	state.ndevices = nspecs;
+	state.start_time = monome_time_usec();
 
-	monome_set_rotation(state.monome, rotate);
-	monome_led_all(state.monome, 0);
+	if( stats_path ) {
+		if( !strcmp(stats_path, "-") )
+			state.stats_file = stderr;
+		else if( !(state.stats_file = fopen(stats_path, "a")) )
+			perror("monomeserial: couldn't open stats file");
 
-	printf("monomeserial version %s, yay!\n\n", VERSION);
-	printf("initialized device %s (%s) at %s, which is %dx%d using proto %s\n",
-		   monome_get_serial(state.monome), monome_get_friendly_name(state.monome),
-		   monome_get_devpath(state.monome),
-		   monome_get_rows(state.monome), monome_get_cols(state.monome),
-		   monome_get_proto(state.monome));
-	printf("running with prefix /%s\n\n", state.lo_prefix);
+		state.stats_interval = stats_interval * 1000000ULL;
+		state.next_dump = state.start_time + state.stats_interval;
+	}
+
+	/* main_loop() only returns if something has gone badly wrong */
+	main_loop();
 
-	/* main_loop() returns 1 if the monome was disconnected */
-	if( main_loop() )
-		printf("%s disconnected, monomeserial exiting.\nsee you later!\n\n",
-			   monome_get_devpath(state.monome));
+	if( state.stats_file ) {
+		stats_dump(state.stats_file, monome_time_usec());
 
-	monome_close(state.monome);
+		if( state.stats_file != stderr )
+			fclose(state.stats_file);
+	}
 
-	unregister_osc_methods(state.lo_prefix);
-	m_free(state.lo_prefix);
+out:
+	for( i = 0; i < state.ndevices; i++ )
+		device_close(&state.devices[i]);
 
-	lo_address_free(state.outgoing);
-	lo_server_free(state.server);
+	m_free(state.devices);
+
+	if( specs != default_spec )
+		m_free(specs);
+	else
+		m_free(default_spec[0]);
 
 	return EXIT_SUCCESS;
 }
@@ -30,6 +30,10 @@ static struct monome_proto g_protos[] = {
 	{ "40h",    monome_protocol_40h_new },
 	{ "series", monome_protocol_series_new },
 	{ "mext",   monome_protocol_mext_new },
+	{ "tile",   monome_protocol_tile_new },
+#if defined(__linux__)
+	{ "shm",    monome_protocol_shm_new },
+#endif
 #if defined(BUILD_OSC_PROTO)
 	{ "osc",    monome_protocol_osc_new },
 #endif
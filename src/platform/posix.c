@@ -26,10 +26,13 @@
 #include <sys/select.h>
 #include <termios.h>
 #include <errno.h>
+#include <time.h>
 
 #include <monome.h>
 #include "internal.h"
 #include "platform.h"
+#include "capture.h"
+#include "schedule.h"
 
 #define MONOME_BAUD_RATE B115200
 #define READ_TIMEOUT 25
@@ -99,6 +102,9 @@ int monome_platform_open(monome_t *monome, const monome_devmap_t *m,
 	struct termios nt, ot;
 	int fd;
 
+	if( monome_replay_is_dev(dev) )
+		return !!monome_replay_start(monome, dev);
+
 	if( (fd = open(dev, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0 ) {
 		perror("libmonome: could not open monome device");
 		return 1;
@@ -140,6 +146,8 @@ int monome_platform_open(monome_t *monome, const monome_devmap_t *m,
 	tcflush(fd, TCIOFLUSH);
 
 	monome->fd = fd;
+
+	monome_capture_start(monome, dev);
 	return 0;
 
 err_tcsetattr:
@@ -150,11 +158,33 @@ err_tcsetattr:
 }
 
 int monome_platform_close(monome_t *monome) {
+	/* when replaying, fd belongs to the capture file */
+	if( monome_replay_active(monome) ) {
+		monome_capture_stop(monome);
+		return 0;
+	}
+
+	monome_capture_stop(monome);
 	return close(monome->fd);
 }
 
 ssize_t monome_platform_write(monome_t *monome, const uint8_t *buf, size_t nbyte) {
-	ssize_t ret = write(monome->fd, buf, nbyte);
+	ssize_t ret;
+
+	if( monome_scheduler_capturing(monome) )
+		return monome_scheduler_capture(monome, buf, nbyte);
+
+	if( monome_replay_active(monome) )
+		return nbyte;
+
+	ret = write(monome->fd, buf, nbyte);
+
+	if( ret > 0 ) {
+		monome->io.writes++;
+		monome->io.bytes_written += ret;
+
+		monome_capture_record(monome, CAPTURE_WRITE, buf, ret);
+	}
 
 	if( ret < nbyte )
 		perror("libmonome: write is missing bytes");
@@ -165,7 +195,7 @@ ssize_t monome_platform_write(monome_t *monome, const uint8_t *buf, size_t nbyte
 	return ret;
 }
 
-ssize_t monome_platform_read(monome_t *monome, uint8_t *buf, size_t nbyte) {
+static ssize_t platform_read(monome_t *monome, uint8_t *buf, size_t nbyte) {
 	ssize_t bytes, ret = 0;
 	int err;
 
@@ -181,7 +211,7 @@ ssize_t monome_platform_read(monome_t *monome, uint8_t *buf, size_t nbyte) {
 start:
 		if ((bytes = read(monome->fd, buf, nbyte)) < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				return 0;
+				return ret;
 			if (errno == EINTR)
 				goto start;
 
@@ -195,31 +225,64 @@ start:
 	return ret;
 }
 
+ssize_t monome_platform_read(monome_t *monome, uint8_t *buf, size_t nbyte) {
+	ssize_t ret;
+
+	if( monome_replay_active(monome) )
+		return monome_replay_read(monome, buf, nbyte);
+
+	ret = platform_read(monome, buf, nbyte);
+
+	if( ret > 0 ) {
+		monome->io.reads++;
+		monome->io.bytes_read += ret;
+
+		monome_capture_record(monome, CAPTURE_READ, buf, ret);
+	}
+
+	return ret;
+}
+
 void monome_event_loop(monome_t *monome) {
 	monome_callback_t *handler;
+	struct timeval tv;
 	monome_event_t e;
+	int timeout;
 
 	fd_set fds;
 
 	e.monome = monome;
 
 	do {
+		/* write out any scheduled updates that are due, and wake up in time
+		   for the next one */
+		timeout = monome_schedule_run(monome);
+
+		tv.tv_sec  = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+
 		FD_ZERO(&fds);
 		FD_SET(monome->fd, &fds);
 
-		if( select(monome->fd + 1, &fds, NULL, NULL, NULL) < 0 ) {
+		if( select(monome->fd + 1, &fds, NULL, NULL,
+		           (timeout < 0) ? NULL : &tv) < 0 ) {
 			perror("libmonome: error in select()");
 			break;
 		}
 
-		if( monome->next_event(monome, &e) < 1 )
-			continue;
+		/* protocols may read ahead of the event they return (see encoder
+		   coalescing), so keep going until they run dry rather than going
+		   back to select() with an event still buffered. */
+		while( monome_event_next(monome, &e) > 0 ) {
+			handler = &monome->handlers[e.event_type];
+			if( !handler->cb )
+				continue;
 
-		handler = &monome->handlers[e.event_type];
-		if( !handler->cb )
-			continue;
+			handler->cb(&e, handler->data);
+		}
 
-		handler->cb(&e, handler->data);
+		if( monome_replay_active(monome) && monome_replay_done(monome) )
+			break;
 	} while( 1 );
 }
 
@@ -242,3 +305,10 @@ void m_free(void *ptr) {
 void m_sleep(uint_t msec) {
 	usleep(msec * 1000);
 }
+
+uint64_t m_time_usec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
@@ -37,6 +37,7 @@
 #include <monome.h>
 #include "internal.h"
 #include "platform.h"
+#include "schedule.h"
 
 #define READ_TIMEOUT 25
 
@@ -213,6 +214,9 @@ ssize_t monome_platform_write(monome_t *monome, const uint8_t *buf, size_t nbyte
 	OVERLAPPED ov = {0, 0, {{0, 0}}};
 	DWORD written = 0;
 
+	if( monome_scheduler_capturing(monome) )
+		return monome_scheduler_capture(monome, buf, nbyte);
+
 	if( !(ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) ) {
 		fprintf(stderr,
 				"monome_plaform_write(): could not allocate event (%ld)\n",
@@ -231,6 +235,10 @@ ssize_t monome_platform_write(monome_t *monome, const uint8_t *buf, size_t nbyte
 	}
 
 	CloseHandle(ov.hEvent);
+
+	monome->io.writes++;
+	monome->io.bytes_written += written;
+
 	return written;
 }
 
@@ -253,10 +261,8 @@ ssize_t monome_platform_read(monome_t *monome, uint8_t *buf, size_t nbyte) {
 	while (read_total < nbyte) {
 		err = monome_platform_wait_for_input(monome, READ_TIMEOUT);
 
-		if (err > 0) {
-			CloseHandle(ov.hEvent);
-			return read_total;
-		}
+		if (err > 0)
+			break;
 
 		if (err < 0) {
 			CloseHandle(ov.hEvent);
@@ -283,6 +289,11 @@ start:
 
 	CloseHandle(ov.hEvent);
 
+	if (read_total) {
+		monome->io.reads++;
+		monome->io.bytes_read += read_total;
+	}
+
 	return read_total;
 }
 
@@ -407,3 +418,13 @@ void m_free(void *ptr) {
 void m_sleep(uint_t msec) {
 	Sleep(msec);
 }
+
+uint64_t m_time_usec(void) {
+	LARGE_INTEGER freq, now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (uint64_t) ((now.QuadPart / freq.QuadPart) * 1000000
+		+ ((now.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+/**
+ * capture files start with a header naming the device they were taken from:
+ *
+ *     "mcap" | version (u8) | serial length (u8) | serial
+ *
+ * followed by one record per chunk read from or written to the device:
+ *
+ *     direction (u8) | usec since previous record (u32le) | length (u16le) | bytes
+ */
+
+#define MONOME_REPLAY_PREFIX "replay://"
+
+typedef enum {
+	CAPTURE_READ  = 0,
+	CAPTURE_WRITE = 1
+} monome_capture_dir_t;
+
+/* starts a capture if MONOME_CAPTURE names a file in the environment */
+void monome_capture_start(monome_t *monome, const char *dev);
+void monome_capture_record(monome_t *monome, monome_capture_dir_t dir,
+                           const uint8_t *buf, size_t nbyte);
+
+/* "replay://file" plays back as fast as it is read,
+   "replay://file?realtime" keeps the recorded timing. */
+int monome_replay_is_dev(const char *dev);
+char *monome_replay_get_serial(const char *dev);
+int monome_replay_start(monome_t *monome, const char *dev);
+int monome_replay_active(monome_t *monome);
+int monome_replay_done(monome_t *monome);
+ssize_t monome_replay_read(monome_t *monome, uint8_t *buf, size_t nbyte);
+
+void monome_capture_stop(monome_t *monome);
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <monome.h>
+#include "internal.h"
+
+#define MONOME_LAYER_MAX 8
+
+struct monome_compositor {
+	/* in the current (rotated) orientation, same as the framebuffer */
+	uint_t rows, cols;
+
+	/* bottom first. allocated as they're asked for. */
+	uint8_t *layers[MONOME_LAYER_MAX];
+	monome_blend_t blend[MONOME_LAYER_MAX];
+
+	/* one bit per 8x8 tile, laid out like the framebuffer's */
+	uint64_t dirty;
+};
+
+uint8_t *monome_compositor_layer_get(monome_t *monome, uint_t layer);
+int monome_compositor_set_blend(monome_t *monome, uint_t layer,
+                                monome_blend_t blend);
+void monome_compositor_mark_dirty(monome_t *monome, uint_t x, uint_t y,
+                                  uint_t w, uint_t h);
+void monome_compositor_compose(monome_t *monome);
+void monome_compositor_reset(monome_t *monome);
+void monome_compositor_free(monome_t *monome);
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+/* stored in the shadow for leds whose state on the device is unknown, never
+   compares equal to a real level. */
+#define FB_UNKNOWN 0xFF
+
+/* the dirty mask has one bit per 8x8 quadrant, which caps us at 64x64 */
+#define FB_MAX_SIDE 64
+
+struct monome_framebuffer {
+	/* in the current (rotated) orientation */
+	uint_t rows, cols;
+
+	/* what the application wants on the grid */
+	uint8_t *levels;
+
+	/* what we last sent to the device */
+	uint8_t *shadow;
+
+	uint64_t dirty;
+
+	/* page flipping, see monome_framebuffer_begin(). there are three pages
+	   so that neither side ever waits: back belongs to the renderer, front
+	   to the flusher, and commits trade places with whatever sits in
+	   committed, which also carries FB_FRESH until the flusher takes it. */
+	uint8_t *pages[3];
+	uint8_t *back, *last;
+	uint8_t *front;
+	uintptr_t committed;
+};
+
+uint8_t *monome_framebuffer_get(monome_t *monome);
+void monome_framebuffer_mark_dirty(monome_t *monome, uint_t x, uint_t y,
+                                   uint_t w, uint_t h);
+int monome_framebuffer_flush(monome_t *monome);
+
+int monome_framebuffer_copy(monome_t *monome, uint_t sx, uint_t sy,
+                            uint_t w, uint_t h, uint_t dx, uint_t dy);
+int monome_framebuffer_shift(monome_t *monome, uint_t x, uint_t y, uint_t w,
+                             uint_t h, int dx, int dy, uint_t fill);
+int monome_framebuffer_blit(monome_t *monome, uint_t x, uint_t y, uint_t w,
+                            uint_t h, const uint8_t *src, size_t stride,
+                            monome_blend_t blend);
+
+uint8_t *monome_framebuffer_begin(monome_t *monome);
+int monome_framebuffer_commit(monome_t *monome);
+
+void monome_framebuffer_reset(monome_t *monome);
+void monome_framebuffer_free(monome_t *monome);
@@ -35,11 +35,22 @@ typedef enum {
 typedef struct monome_callback monome_callback_t;
 typedef struct monome_rotspec monome_rotspec_t;
 typedef struct monome_devmap monome_devmap_t;
+typedef struct monome_led_costs monome_led_costs_t;
+typedef struct monome_framebuffer monome_framebuffer_t;
+typedef struct monome_compositor monome_compositor_t;
+typedef struct monome_led_ring_costs monome_led_ring_costs_t;
+typedef struct monome_ring_shadow monome_ring_shadow_t;
+typedef struct monome_keystate monome_keystate_t;
+typedef struct monome_tilt_filter monome_tilt_filter_t;
+typedef struct monome_capture monome_capture_t;
+typedef struct monome_schedule monome_schedule_t;
+typedef struct monome_shm_broker monome_shm_broker_t;
 
 typedef struct monome_led_functions monome_led_functions_t;
 typedef struct monome_led_level_functions monome_led_level_functions_t;
 typedef struct monome_led_ring_functions monome_led_ring_functions_t;
 typedef struct monome_tilt_functions monome_tilt_functions_t;
+typedef struct monome_output_functions monome_output_functions_t;
 
 typedef void (*monome_coord_cb_t)(monome_t *, uint_t *x, uint_t *y);
 typedef void (*monome_map_cb_t)(monome_t *, uint8_t *data);
@@ -76,6 +87,62 @@ struct monome_rotspec {
 	} flags;
 };
 
+/* bytes on the wire for each led message, used by the framebuffer to pick
+   the cheapest encoding for a set of changes. a cost of 0 means the protocol
+   has no such message. costs are given in the device's own orientation. */
+
+struct monome_led_costs {
+	uint_t set, all, map, row, col;
+	uint_t level_set, level_all, level_map, level_row, level_col;
+
+	enum {
+		/* levels are thresholded down to on/off before being compared */
+		LED_MONOCHROME      = 0x1,
+
+		/* row and col messages always cover the whole width (or height) of
+		   the grid rather than one 8-led segment of it */
+		LED_LINE_SPANS_GRID = 0x2
+	} flags;
+};
+
+/* the same for the ring messages, used by monome_led_ring_frame(). set and
+   map are required, a cost of 0 for the others means there's no such
+   message. */
+
+struct monome_led_ring_costs {
+	uint_t set, all, map, range;
+};
+
+/* keys currently held down, in the device's own orientation. bit x of
+   rows[y] is set while key (x, y) is held. written only by whoever reads
+   events, read from anywhere under the seqlock in seq. */
+
+#define MONOME_KEYSTATE_ROWS 16
+
+struct monome_keystate {
+	uint32_t seq;
+	uint32_t count;
+	uint16_t rows[MONOME_KEYSTATE_ROWS];
+};
+
+/* per-sensor decimation of tilt events, see tilt.c */
+
+#define MONOME_TILT_SENSORS 8
+
+struct monome_tilt_filter {
+	uint_t interval; /* usec */
+	uint_t threshold;
+
+	int have_last;
+	uint64_t last_time;
+	int x, y, z;
+
+	/* the latest event the rate limit dropped, delivered once the interval
+	   is up so that a sensor coming to rest isn't left reading stale */
+	int have_held;
+	int held_x, held_y, held_z;
+};
+
 /**
  * subsystem functions
  */
@@ -90,6 +157,11 @@ struct monome_led_functions {
 	int (*col)(monome_t *monome, uint_t x, uint_t y_off,
 	           size_t count, const uint8_t *data);
 	int (*intensity)(monome_t *monome, uint_t brightness);
+
+	/* optional. takes the whole grid as a bitmap in the current orientation,
+	   one bit per led and cols / 8 bytes per row, and sends whatever it
+	   takes to get the device showing it. */
+	int (*frame)(monome_t *monome, const uint8_t *bits);
 };
 
 struct monome_led_level_functions {
@@ -101,6 +173,11 @@ struct monome_led_level_functions {
 	           size_t count, const uint8_t *data);
 	int (*col)(monome_t *monome, uint_t x, uint_t y_off,
 	           size_t count, const uint8_t *data);
+
+	/* optional. takes the framebuffer's levels and its dirty mask (one bit
+	   per 8x8 quadrant, row-major) in place of the framebuffer planning
+	   the flush itself. */
+	int (*frame)(monome_t *monome, const uint8_t *levels, uint64_t dirty);
 };
 
 struct monome_led_ring_functions {
@@ -117,6 +194,16 @@ struct monome_tilt_functions {
 	int (*disable)(monome_t *monome, uint_t sensor);
 };
 
+struct monome_output_functions {
+	int (*batch)(monome_t *monome, uint_t enable);
+	int (*flush)(monome_t *monome);
+
+	/* optional. protocols that can have the receiving end do the
+	   scheduling, rather than leaving it to schedule.c */
+	int (*schedule_begin)(monome_t *monome, uint64_t when);
+	int (*schedule_end)(monome_t *monome);
+};
+
 struct monome {
 #if !defined(EMBED_PROTOS)
 	/* handle for the loaded protocol module */
@@ -134,6 +221,25 @@ struct monome {
 	monome_callback_t handlers[MONOME_EVENT_MAX];
 	monome_rotate_t rotation;
 
+	/* set by protocols whose grid can't be rotated, such as virtual ones
+	   whose members are rotated instead. monome_set_rotation() does
+	   nothing on them. */
+	int fixed_rotation;
+
+	/* counted by the platform read and write functions */
+	monome_io_stats_t io;
+
+	monome_keystate_t keys;
+
+	/* sum runs of encoder deltas into one event, waiting up to window msec
+	   for more to arrive */
+	struct {
+		int enabled;
+		uint_t window;
+	} coalesce;
+
+	monome_tilt_filter_t tilt_filters[MONOME_TILT_SENSORS];
+
 	int  (*open)(monome_t *monome, const char *dev, const char *serial,
 				 const monome_devmap_t *, va_list args);
 	int  (*close)(monome_t *monome);
@@ -141,10 +247,31 @@ struct monome {
 
 	int  (*next_event)(monome_t *monome, monome_event_t *event);
 
+	/* optional. whether events have already been read off the fd and are
+	   waiting for next_event(), in which case the fd won't say so. */
+	int  (*pending)(monome_t *monome);
+
 	monome_led_functions_t *led;
 	monome_led_level_functions_t *led_level;
 	monome_led_ring_functions_t *led_ring;
 	monome_tilt_functions_t *tilt;
+	monome_output_functions_t *output;
+
+	const monome_led_costs_t *led_costs;
+	monome_framebuffer_t *fb;
+	monome_compositor_t *compositor;
+
+	const monome_led_ring_costs_t *ring_costs;
+	monome_ring_shadow_t *rings;
+
+	/* set while capturing to or replaying from a file, see capture.c */
+	monome_capture_t *capture;
+
+	/* led updates waiting for their deadline, see schedule.c */
+	monome_schedule_t *sched;
+
+	/* set while the device is shared with other processes, see shm.c */
+	monome_shm_broker_t *shm;
 };
 
 #endif /* defined MONOME_INTERNAL_H */
@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+/* all coordinates are raw device coordinates, i.e. before UNROTATE_COORDS */
+void monome_keystate_update(monome_t *monome, uint_t x, uint_t y, int down);
+
+int monome_keystate_get(monome_t *monome, uint_t x, uint_t y);
+uint_t monome_keystate_count(monome_t *monome);
+uint_t monome_keystate_snapshot(monome_t *monome, uint16_t *rows);
+
+/* the same for a keystate that isn't a device's own, such as the one a
+   shared-memory broker publishes */
+void keystate_set(monome_keystate_t *ks, uint_t x, uint_t y, int down);
+uint_t keystate_read(monome_keystate_t *ks, uint16_t *rows);
@@ -17,4 +17,13 @@
 #include "internal.h"
 
 #define reduce_level_to_bit(level) (level > 7)
-uint8_t reduce_levels_to_bitmask(const uint8_t *levels);
\ No newline at end of file
+uint8_t reduce_levels_to_bitmask(const uint8_t *levels);
+
+/* packs count levels (a multiple of 8) into count / 8 bitmasks, lsb first */
+void reduce_levels_to_bitmasks(uint8_t *masks, const uint8_t *levels,
+                               size_t count);
+
+/* packs a row-major 8x8 quadrant into 8 row bitmasks, rotated for the
+   device the way the monome's map_cb would */
+void reduce_quadrant_to_bitmask(monome_t *monome, uint8_t *masks,
+                                const uint8_t *levels);
\ No newline at end of file
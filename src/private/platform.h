@@ -35,3 +35,64 @@ void *m_calloc(size_t nmemb, size_t size);
 void *m_strdup(const char *s);
 void m_free(void *ptr);
 void m_sleep(uint_t msec);
+
+/* monotonic, for measuring intervals only */
+uint64_t m_time_usec(void);
+
+/* the few atomics we need for state that's read from other threads. loads
+   acquire, stores release and m_atomic_fence() is a full barrier. msvc
+   only has full barriers, which is more than we ask for but never less. */
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+static __inline uint16_t m_atomic_load_16(uint16_t *p) {
+	return (uint16_t) _InterlockedOr16((volatile short *) p, 0);
+}
+
+static __inline void m_atomic_store_16(uint16_t *p, uint16_t v) {
+	_InterlockedExchange16((volatile short *) p, (short) v);
+}
+
+static __inline uint32_t m_atomic_load_32(uint32_t *p) {
+	return (uint32_t) _InterlockedOr((volatile long *) p, 0);
+}
+
+static __inline void m_atomic_store_32(uint32_t *p, uint32_t v) {
+	_InterlockedExchange((volatile long *) p, (long) v);
+}
+
+static __inline uintptr_t m_atomic_load_ptr(uintptr_t *p) {
+#if defined(_WIN64)
+	return (uintptr_t) _InterlockedOr64((volatile __int64 *) p, 0);
+#else
+	return (uintptr_t) _InterlockedOr((volatile long *) p, 0);
+#endif
+}
+
+static __inline uintptr_t m_atomic_exchange_ptr(uintptr_t *p, uintptr_t v) {
+#if defined(_WIN64)
+	return (uintptr_t) _InterlockedExchange64((volatile __int64 *) p,
+	                                          (__int64) v);
+#else
+	return (uintptr_t) _InterlockedExchange((volatile long *) p, (long) v);
+#endif
+}
+
+static __inline void m_atomic_fence(void) {
+	volatile long x = 0;
+	_InterlockedOr(&x, 0);
+}
+
+#else
+
+#define m_atomic_load_16(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define m_atomic_store_16(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define m_atomic_load_32(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define m_atomic_store_32(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define m_atomic_load_ptr(p)       __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define m_atomic_exchange_ptr(p, v) \
+	__atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#define m_atomic_fence()           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif
@@ -21,6 +21,10 @@ monome_t *monome_protocol_40h_new(void);
 monome_t *monome_protocol_series_new(void);
 monome_t *monome_protocol_mext_new(void);
 monome_t *monome_protocol_osc_new(void);
+monome_t *monome_protocol_tile_new(void);
+#if defined(__linux__)
+monome_t *monome_protocol_shm_new(void);
+#endif
 #else
 monome_t *monome_protocol_new(void);
 #endif
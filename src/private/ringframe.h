@@ -0,0 +1,44 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+#define MONOME_RING_LEDS 64
+
+/* rings past this are sent whole every time */
+#define MONOME_RING_MAX  8
+
+struct monome_ring_shadow {
+	/* what we last sent to each ring */
+	uint8_t levels[MONOME_RING_MAX][MONOME_RING_LEDS];
+
+	/* one bit per ring, set once its shadow can be trusted */
+	uint_t known;
+};
+
+int monome_ring_frame(monome_t *monome, uint_t ring, const uint8_t *levels);
+
+/* called for everything else sent to a ring, to keep the shadow honest */
+void monome_ring_shadow_set(monome_t *monome, uint_t ring, uint_t led,
+                            uint_t level);
+void monome_ring_shadow_all(monome_t *monome, uint_t ring, uint_t level);
+void monome_ring_shadow_map(monome_t *monome, uint_t ring,
+                            const uint8_t *levels);
+void monome_ring_shadow_range(monome_t *monome, uint_t ring, uint_t start,
+                              uint_t end, uint_t level);
+void monome_ring_shadow_forget(monome_t *monome, uint_t ring);
+
+void monome_ring_shadow_free(monome_t *monome);
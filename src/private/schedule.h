@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+/* a timer wheel of 1 msec ticks. updates further out than the wheel is
+   long share slots with nearer ones and wait for a later lap. */
+#define SCHEDULE_WHEEL_SLOTS 256
+
+typedef struct monome_scheduled monome_scheduled_t;
+
+struct monome_scheduled {
+	monome_scheduled_t *next;
+
+	uint64_t when;
+	size_t len;
+	uint8_t data[];
+};
+
+struct monome_schedule {
+	/* set between begin and end, while writes are diverted into buf */
+	int capturing;
+	uint64_t when;
+
+	uint8_t *buf;
+	size_t len, size;
+
+	/* oldest tick that hasn't been fully released yet */
+	uint64_t tick;
+	uint_t pending;
+
+	struct {
+		monome_scheduled_t *head;
+		monome_scheduled_t **tail;
+	} slots[SCHEDULE_WHEEL_SLOTS];
+};
+
+int monome_scheduler_begin(monome_t *monome, uint64_t when);
+int monome_scheduler_end(monome_t *monome);
+
+int monome_scheduler_capturing(monome_t *monome);
+ssize_t monome_scheduler_capture(monome_t *monome, const uint8_t *buf,
+                                 size_t nbyte);
+
+/* returns msec until the next update is due, or -1 if there is none */
+int monome_scheduler_run(monome_t *monome);
+
+void monome_scheduler_free(monome_t *monome);
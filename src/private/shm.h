@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+/* the segment a broker shares with its clients. everything in it is read
+   and written with atomics, since the other side is another process. */
+
+#define MONOME_SHM_MAGIC    0x6d6f6e6d /* "mnom" */
+#define MONOME_SHM_VERSION  1
+
+#define MONOME_SHM_CLIENTS  4
+#define MONOME_SHM_MAX_LEDS (64 * 64)
+#define MONOME_SHM_EVENTS   256 /* a power of two */
+
+typedef struct monome_shm monome_shm_t;
+typedef struct monome_shm_slot monome_shm_slot_t;
+
+/* grid x, y / encoder number, delta / tilt sensor, x, y, z */
+struct monome_shm_event {
+	uint32_t type;
+	int32_t v[4];
+};
+
+struct monome_shm_slot {
+	/* written by the client. a frame goes into levels[!front], then front
+	   is flipped. seq is odd from the moment the client starts writing
+	   until the flip, and the broker retries any copy it overlapped. */
+	uint32_t seq;
+	uint32_t front;
+	uint8_t levels[2][MONOME_SHM_MAX_LEDS];
+
+	/* events from the broker. it moves head, the client moves tail. */
+	uint32_t head;
+	uint32_t tail;
+	struct monome_shm_event events[MONOME_SHM_EVENTS];
+};
+
+struct monome_shm {
+	uint32_t magic;
+	uint32_t version;
+
+	uint32_t rows, cols;
+	char serial[64];
+
+	/* keys held on the device, in the coordinates events carry */
+	monome_keystate_t keys;
+
+	monome_shm_slot_t slots[MONOME_SHM_CLIENTS];
+};
+
+/* what a client is sent on connecting, along with the segment's memfd and
+   its flush and event eventfds */
+struct monome_shm_hello {
+	uint32_t slot;
+	uint32_t size;
+};
+
+void monome_shm_free(monome_t *monome);
@@ -0,0 +1,31 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "internal.h"
+
+void monome_tilt_filter_set(monome_t *monome, uint_t sensor, uint_t max_rate,
+                            uint_t threshold);
+
+/* returns 1 if the tilt event in e should be delivered, 0 if it should be
+   dropped. */
+int monome_tilt_filter(monome_t *monome, const monome_event_t *e);
+
+/* hands out an event the rate limit held back, once its interval is up.
+   returns 1 if e was filled in. */
+int monome_tilt_filter_next(monome_t *monome, monome_event_t *e);
+
+/* msec until a held event is due, or -1 if there isn't one */
+int monome_tilt_filter_timeout(monome_t *monome);
@@ -24,6 +24,8 @@
 #include "platform.h"
 #include "rotation.h"
 #include "monobright.h"
+#include "keystate.h"
+#include "tilt.h"
 
 #include "40h.h"
 
@@ -38,6 +40,37 @@ static int monome_write(monome_t *monome, const uint8_t *buf, ssize_t bufsize) {
 	return -1;
 }
 
+/* keep the shadow in step with everything else that's sent */
+
+static void shadow_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
+	uint8_t *row = &MONOME_40H_T(monome)->shadow.rows[y];
+
+	*row = (*row & ~(1 << x)) | (!!on << x);
+}
+
+static void shadow_row(monome_t *monome, uint_t y, uint8_t data) {
+	MONOME_40H_T(monome)->shadow.rows[y] = data;
+	MONOME_40H_T(monome)->shadow.known |= 1 << y;
+}
+
+static void shadow_col(monome_t *monome, uint_t x, uint8_t data) {
+	uint_t y;
+
+	for( y = 0; y < 8; y++ )
+		shadow_set(monome, x, y, data & (1 << y));
+}
+
+/* for led writes. if one fails we can't tell what the device got, so the
+   shadow can't be trusted until everything has been sent again. */
+static int shadow_write(monome_t *monome, const uint8_t *buf,
+                        ssize_t bufsize) {
+	if( !monome_write(monome, buf, bufsize) )
+		return 0;
+
+	MONOME_40H_T(monome)->shadow.known = 0;
+	return -1;
+}
+
 static int proto_40h_led_col_row(monome_t *monome, proto_40h_message_t mode, uint_t address, const uint8_t *data) {
 	uint8_t buf[2];
 	uint_t xaddress = address;
@@ -72,7 +105,39 @@ static int proto_40h_led_col_row(monome_t *monome, proto_40h_message_t mode, uin
 
 	buf[0] = mode | (address & 0x7 );
 
-	return monome_write(monome, buf, sizeof(buf));
+	if( mode == PROTO_40h_LED_ROW )
+		shadow_row(monome, address & 0x7, buf[1]);
+	else
+		shadow_col(monome, address & 0x7, buf[1]);
+
+	return shadow_write(monome, buf, sizeof(buf));
+}
+
+/* rows is already in the device's orientation. only rows that differ from
+   what the device has are sent, all in one write. */
+static int proto_40h_write_map(monome_t *monome, const uint8_t *rows) {
+	monome_40h_t *m40h = MONOME_40H_T(monome);
+	uint8_t buf[16];
+	uint_t i, len;
+
+	for( i = len = 0; i < 8; i++ ) {
+		if( (m40h->shadow.known & (1 << i)) && m40h->shadow.rows[i] == rows[i] )
+			continue;
+
+		buf[len++] = PROTO_40h_LED_ROW | i;
+		buf[len++] = rows[i];
+	}
+
+	if( !len )
+		return 0;
+
+	if( shadow_write(monome, buf, len) )
+		return -1;
+
+	memcpy(m40h->shadow.rows, rows, 8);
+	m40h->shadow.known = 0xFF;
+
+	return 0;
 }
 
 /**
@@ -80,15 +145,19 @@ static int proto_40h_led_col_row(monome_t *monome, proto_40h_message_t mode, uin
  */
 
 static int proto_40h_led_all(monome_t *monome, uint_t status) {
+	monome_40h_t *m40h = MONOME_40H_T(monome);
+	uint8_t buf[16];
 	uint_t i;
-	uint8_t buf[2] = {0, (status) ? 0xFF : 0};
 
 	for( i = 0; i < 8; i++ ) {
-		buf[0] = PROTO_40h_LED_ROW | (i & 0xF);
-		monome_write(monome, buf, sizeof(buf));
+		buf[i * 2] = PROTO_40h_LED_ROW | i;
+		buf[(i * 2) + 1] = (status) ? 0xFF : 0;
 	}
 
-	return sizeof(buf) * i;
+	memset(m40h->shadow.rows, buf[1], 8);
+	m40h->shadow.known = 0xFF;
+
+	return shadow_write(monome, buf, sizeof(buf));
 }
 
 static int proto_40h_intensity(monome_t *monome, uint_t brightness) {
@@ -107,7 +176,9 @@ static int proto_40h_led_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
 	buf[0] = PROTO_40h_LED_OFF + !!on;
 	buf[1] = (x << 4) | y;
 
-	return monome_write(monome, buf, sizeof(buf));
+	shadow_set(monome, x, y, on);
+
+	return shadow_write(monome, buf, sizeof(buf));
 }
 
 static int proto_40h_led_col(monome_t *monome, uint_t x, uint_t y_off,
@@ -123,16 +194,19 @@ static int proto_40h_led_row(monome_t *monome, uint_t x_off, uint_t y,
 static int proto_40h_led_map(monome_t *monome, uint_t x_off, uint_t y_off,
                              const uint8_t *data) {
 	uint8_t buf[8];
-	int ret = 0;
-	uint_t i;
+
+	/* there's only the one quadrant */
+	if( x_off > 7 || y_off > 7 )
+		return 0;
 
 	memcpy(buf, data, 8);
 	ROTSPEC(monome).map_cb(monome, buf);
 
-	for( i = 0; i < 8; i++ )
-		ret += proto_40h_led_col_row(monome, PROTO_40h_LED_ROW, i, &buf[i]);
+	return proto_40h_write_map(monome, buf);
+}
 
-	return ret;
+static int proto_40h_led_frame(monome_t *monome, const uint8_t *bits) {
+	return proto_40h_led_map(monome, 0, 0, bits);
 }
 
 static monome_led_functions_t proto_40h_led_functions = {
@@ -141,7 +215,8 @@ static monome_led_functions_t proto_40h_led_functions = {
 	.map = proto_40h_led_map,
 	.row = proto_40h_led_row,
 	.col = proto_40h_led_col,
-	.intensity = proto_40h_intensity
+	.intensity = proto_40h_intensity,
+	.frame = proto_40h_led_frame
 };
 
 /**
@@ -158,45 +233,35 @@ static int proto_40h_led_level_all(monome_t *monome, uint_t level) {
 
 static int proto_40h_led_level_map(monome_t *monome, uint_t x_off,
 		uint_t y_off, const uint8_t *data) {
-	uint8_t levels[64];
 	uint8_t masks[8];
-	uint_t i;
 
-	/* don't rotate coords here like you would in mext, since rotate happens
-	 * in the call to the normal led_map function
-	 */
-	ROTSPEC(monome).level_map_cb(monome, levels, data);
+	if( x_off > 7 || y_off > 7 )
+		return 0;
 
-	/* reduce the level data into a bitmask */
-	for (i = 0; i < 8; ++i) {
-		masks[i] = reduce_levels_to_bitmask(&levels[i * 8]);
-	};
-	return proto_40h_led_map(monome, x_off, y_off, masks);
+	/* threshold, pack and rotate in one go */
+	reduce_quadrant_to_bitmask(monome, masks, data);
+	return proto_40h_write_map(monome, masks);
 }
 
 
 static int proto_40h_led_level_row(monome_t *monome, uint_t x_off,
 		uint_t row, size_t count, const uint8_t *data) {
-	uint_t i, chunks;
 	uint8_t masks[2];
+	uint_t chunks;
 
 	chunks = count / 8;
-	for (i = 0; i < chunks; ++i) {
-		masks[i] = reduce_levels_to_bitmask(&data[i*8]);
-	}
+	reduce_levels_to_bitmasks(masks, data, chunks * 8);
 
 	return proto_40h_led_row(monome, x_off, row, chunks, masks);
 }
 
 static int proto_40h_led_level_col(monome_t *monome, uint_t col,
 		uint_t y_off, size_t count, const uint8_t *data) {
-	uint_t i, chunks;
 	uint8_t masks[2];
+	uint_t chunks;
 
 	chunks = count / 8;
-	for (i = 0; i < chunks; ++i) {
-		masks[i] = reduce_levels_to_bitmask(&data[i*8]);
-	}
+	reduce_levels_to_bitmasks(masks, data, chunks * 8);
 
 	return proto_40h_led_col(monome, col, y_off, chunks, masks);
 }
@@ -230,6 +295,22 @@ static monome_tilt_functions_t proto_40h_tilt_functions = {
 	.disable = proto_40h_tilt_disable
 };
 
+/**
+ * led costs
+ *
+ * the 40h has no map or clear messages, both go out as 8 row messages.
+ */
+
+static monome_led_costs_t proto_40h_led_costs = {
+	.set = 2,
+	.all = 16,
+	.map = 16,
+	.row = 2,
+	.col = 2,
+
+	.flags = LED_MONOCHROME
+};
+
 /**
  * module interface
  */
@@ -249,6 +330,8 @@ static int proto_40h_next_event(monome_t *monome, monome_event_t *e) {
 		e->grid.x = buf[1] >> 4;
 		e->grid.y = buf[1] & 0xF;
 
+		monome_keystate_update(monome, e->grid.x, e->grid.y,
+		                       e->event_type == MONOME_BUTTON_DOWN);
 		UNROTATE_COORDS(monome, e->grid.x, e->grid.y);
 		return 1;
 
@@ -271,7 +354,7 @@ tilt_common: /* I SAID SHUT UP */
 		e->tilt.x = MONOME_40H_T(monome)->tilt.x;
 		e->tilt.y = MONOME_40H_T(monome)->tilt.y;
 		e->tilt.z = 0;
-		return 1;
+		return monome_tilt_filter(monome, e);
 	}
 
 	return 0;
@@ -317,6 +400,7 @@ monome_t *monome_protocol_new(void) {
 	monome->led_level = &proto_40h_led_level_functions;
 	monome->led_ring = NULL;
 	monome->tilt = &proto_40h_tilt_functions;
+	monome->led_costs = &proto_40h_led_costs;
 
 	MONOME_40H_T(monome)->tilt.x = 0;
 	MONOME_40H_T(monome)->tilt.y = 0;
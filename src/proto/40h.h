@@ -44,7 +44,14 @@ typedef struct monome_40h monome_40h_t;
 
 struct monome_40h {
 	monome_t parent;
-	
+
+	/* the leds as last sent, in the device's own orientation. bit y of
+	   `known` is set once all of row y has been sent. */
+	struct {
+		uint8_t rows[8];
+		uint8_t known;
+	} shadow;
+
 	struct {
 		int x;
 		int y;
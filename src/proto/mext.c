@@ -23,6 +23,8 @@
 #include "internal.h"
 #include "platform.h"
 #include "rotation.h"
+#include "keystate.h"
+#include "tilt.h"
 
 #include "mext.h"
 
@@ -498,11 +500,50 @@ static int mext_handler_key_grid(struct mext *self,
 	e->event_type = ( msg->cmd == CMD_KEY_DOWN ) ? MONOME_BUTTON_DOWN : MONOME_BUTTON_UP;
 	e->grid.x = msg->payload.key.x;
 	e->grid.y = msg->payload.key.y;
+
+	monome_keystate_update(MONOME_T(self), e->grid.x, e->grid.y,
+	                       e->event_type == MONOME_BUTTON_DOWN);
 	UNROTATE_COORDS(MONOME_T(self), e->grid.x, e->grid.y);
 
 	return 1;
 }
 
+/* fold any deltas for the same encoder that follow this one into it. the
+   first message that doesn't match is kept back for the next call. */
+static void mext_coalesce_deltas(struct mext *self, monome_event_t *e) {
+	monome_t *monome = MONOME_T(self);
+	uint64_t now, deadline;
+	mext_msg_t msg;
+	ssize_t status;
+
+	deadline = m_time_usec() + (monome->coalesce.window * 1000);
+
+	do {
+		if( (status = mext_read_msg(monome, &msg)) < 0 )
+			return;
+
+		if( !status ) {
+			if( (now = m_time_usec()) >= deadline )
+				return;
+
+			if( monome_platform_wait_for_input(monome,
+			        ((deadline - now) + 999) / 1000) )
+				return;
+
+			continue;
+		}
+
+		if( msg.addr != SS_ENCODER || msg.cmd != CMD_ENCODER_DELTA
+			|| msg.payload.encoder.number != e->encoder.number ) {
+			self->pending = msg;
+			self->have_pending = 1;
+			return;
+		}
+
+		e->encoder.delta += msg.payload.encoder.delta;
+	} while( 1 );
+}
+
 static int mext_handler_encoder(struct mext *self, const struct mext_msg *msg,
 		monome_event_t *e) {
 	switch( msg->cmd ) {
@@ -510,6 +551,10 @@ static int mext_handler_encoder(struct mext *self, const struct mext_msg *msg,
 		e->event_type = MONOME_ENCODER_DELTA;
 		e->encoder.number = msg->payload.encoder.number;
 		e->encoder.delta = msg->payload.encoder.delta;
+
+		if( MONOME_T(self)->coalesce.enabled )
+			mext_coalesce_deltas(self, e);
+
 		return 1;
 
 	case CMD_ENCODER_SWITCH_DOWN:
@@ -544,7 +589,7 @@ static int mext_handler_tilt(struct mext *self, const struct mext_msg *msg,
 		e->tilt.y = msg->payload.tilt.y;
 		e->tilt.z = msg->payload.tilt.z;
 
-		return 1;
+		return monome_tilt_filter(MONOME_T(self), e);
 
 	default:
 		break;
@@ -566,12 +611,30 @@ static mext_handler_t subsystem_event_handlers[16] = {
  * device control functions
  */
 
+static ssize_t mext_next_msg(monome_t *monome, mext_msg_t *msg) {
+	SELF_FROM(monome);
+
+	if( !self->have_pending )
+		return mext_read_msg(monome, msg);
+
+	*msg = self->pending;
+	self->have_pending = 0;
+
+	return 1;
+}
+
+/* a message read past the end of a run of coalesced deltas */
+static int mext_pending(monome_t *monome) {
+	SELF_FROM(monome);
+	return self->have_pending;
+}
+
 static int mext_next_event(monome_t *monome, monome_event_t *e) {
 	SELF_FROM(monome);
 	mext_msg_t msg = {0, 0};
 	ssize_t status;
 
-	while ((status = mext_read_msg(monome, &msg)) > 0) {
+	while ((status = mext_next_msg(monome, &msg)) > 0) {
 		if (msg.addr == SS_SYSTEM) {
 			subsystem_event_handlers[0](self, &msg, e);
 			continue;
@@ -642,12 +705,43 @@ monome_t *monome_protocol_new(void) {
 	monome->free  = mext_free;
 
 	monome->next_event = mext_next_event;
+	monome->pending    = mext_pending;
 
 	monome->led = &mext_led_functions;
 	monome->led_level = &mext_led_level_functions;
 	monome->led_ring = &mext_led_ring_functions;
 	monome->tilt = &mext_tilt_functions;
 
+#define LED_COST(cmd) (1 + outgoing_payload_lengths[SS_LED_GRID][cmd])
+	self->led_costs = (monome_led_costs_t) {
+		.set = LED_COST(CMD_LED_ON),
+		.all = LED_COST(CMD_LED_ALL_ON),
+		.map = LED_COST(CMD_LED_MAP),
+		.row = LED_COST(CMD_LED_ROW),
+		.col = LED_COST(CMD_LED_COLUMN),
+
+		.level_set = LED_COST(CMD_LED_LEVEL_SET),
+		.level_all = LED_COST(CMD_LED_LEVEL_ALL),
+		.level_map = LED_COST(CMD_LED_LEVEL_MAP),
+		.level_row = LED_COST(CMD_LED_LEVEL_ROW),
+		.level_col = LED_COST(CMD_LED_LEVEL_COLUMN),
+
+		.flags = 0
+	};
+#undef LED_COST
+
+#define RING_COST(cmd) (1 + outgoing_payload_lengths[SS_LED_RING][cmd])
+	self->ring_costs = (monome_led_ring_costs_t) {
+		.set   = RING_COST(CMD_LED_RING_SET),
+		.all   = RING_COST(CMD_LED_RING_ALL),
+		.map   = RING_COST(CMD_LED_RING_MAP),
+		.range = RING_COST(CMD_LED_RING_RANGE)
+	};
+#undef RING_COST
+
+	monome->led_costs = &self->led_costs;
+	monome->ring_costs = &self->ring_costs;
+
 	self->need_responses =
 		MEXT_NEED_QUERY | MEXT_NEED_ID | MEXT_NEED_GRID_SIZE;
 
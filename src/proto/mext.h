@@ -197,13 +197,6 @@ typedef enum {
 	MEXT_NEED_GRID_SIZE = 1 << 2
 } mext_need_responses_t;
 
-struct mext {
-	monome_t monome;
-
-	mext_need_responses_t need_responses;
-	char id[33];
-};
-
 struct mext_point {
 	uint8_t x;
 	uint8_t y;
@@ -324,3 +317,17 @@ struct mext_msg {
 		} PACKED tilt;
 	} PACKED payload;
 } PACKED;
+
+struct mext {
+	monome_t monome;
+
+	mext_need_responses_t need_responses;
+	char id[33];
+
+	monome_led_costs_t led_costs;
+	monome_led_ring_costs_t ring_costs;
+
+	/* a message read ahead while coalescing that still needs handling */
+	int have_pending;
+	mext_msg_t pending;
+};
@@ -19,16 +19,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <netdb.h>
+#endif
+
 #include <lo/lo.h>
 
 #include <monome.h>
 #include "platform.h"
 #include "internal.h"
+#include "keystate.h"
+#include "tilt.h"
 
 #include "osc.h"
 
 #define SELF_FROM(what_okay) monome_osc_t *self = (monome_osc_t *) what_okay;
-#define LO_SEND_MSG(type, ...) lo_send_from(self->outgoing, self->server, LO_TT_IMMEDIATE, self->type##_str, __VA_ARGS__)
+#define OSC_SEND(tmpl, ...) \
+	proto_osc_send_template(self, &self->tmpl, (const int32_t []) { __VA_ARGS__ })
+
+/* "#bundle\0" and the timetag */
+#define OSC_BUNDLE_HEADER_LEN 16
 
 #define OSC_HANDLER_FUNC(x)\
 	static int x(const char *path, const char *types,\
@@ -37,6 +49,7 @@
 
 static int proto_osc_close(monome_t *monome);
 static void proto_osc_free(monome_t *monome);
+static int proto_osc_flush(monome_t *monome);
 
 /**
  * private
@@ -47,42 +60,61 @@ static void proto_osc_lo_error(int num, const char *error_msg, const char *path)
 	fflush(stderr);
 }
 
+static uint_t proto_osc_queued(monome_osc_t *self) {
+	return self->queue.tail - self->queue.head;
+}
+
+/* next_event() leaves enough room for a whole datagram, so the queue can
+   only be full if that arithmetic is wrong. NULL drops the event then. */
+static monome_event_t *proto_osc_queue_push(monome_osc_t *self) {
+	monome_event_t *e;
+
+	if( proto_osc_queued(self) == OSC_EVENT_QUEUE_LEN )
+		return NULL;
+
+	e = &self->queue.events[self->queue.tail++ & (OSC_EVENT_QUEUE_LEN - 1)];
+	e->monome = &self->parent;
+
+	return e;
+}
+
 OSC_HANDLER_FUNC(proto_osc_press_handler) {
 	SELF_FROM(user_data);
-	monome_event_t *e = self->e_ptr;
+	monome_event_t *e;
 
-	if( !e )
-		return 1;
+	if( !(e = proto_osc_queue_push(self)) )
+		return 0;
 
 	e->grid.x     = argv[0]->i;
 	e->grid.y     = argv[1]->i;
 	e->event_type = argv[2]->i & 1;
 
-	self->have_event = 1;
+	monome_keystate_update(&self->parent, e->grid.x, e->grid.y,
+	                       e->event_type == MONOME_BUTTON_DOWN);
+
 	return 0;
 }
 
 OSC_HANDLER_FUNC(proto_osc_delta_handler) {
 	SELF_FROM(user_data);
-	monome_event_t *e = self->e_ptr;
+	monome_event_t *e;
 
-	if( !e )
-		return 1;
+	if( !(e = proto_osc_queue_push(self)) )
+		return 0;
 
 	e->event_type = MONOME_ENCODER_DELTA;
 	e->encoder.number = argv[0]->i;
 	e->encoder.delta = argv[1]->i;
 
-	self->have_event = 1;
 	return 0;
 }
 
 OSC_HANDLER_FUNC(proto_osc_enc_key_handler) {
 	SELF_FROM(user_data);
-	monome_event_t *e = self->e_ptr;
+	monome_event_t *e;
 
-	if( !e )
-		return 1;
+	if( !(e = proto_osc_queue_push(self)) )
+		return 0;
 
 	if( argv[1]->i )
 		e->event_type = MONOME_ENCODER_KEY_DOWN;
@@ -90,22 +122,250 @@ OSC_HANDLER_FUNC(proto_osc_enc_key_handler) {
 		e->event_type = MONOME_ENCODER_KEY_UP;
 	e->encoder.number = argv[0]->i;
 
-	self->have_event = 1;
+	return 0;
+}
+
+/* the reply to the /sys/info we sent on open. the grid's size never
+   changes, and the framebuffer is sized from the first answer. */
+OSC_HANDLER_FUNC(proto_osc_size_handler) {
+	SELF_FROM(user_data);
+
+	if( self->parent.rows || argv[0]->i <= 0 || argv[1]->i <= 0 )
+		return 0;
+
+	self->parent.cols = argv[0]->i;
+	self->parent.rows = argv[1]->i;
+
+	return 0;
+}
+
+OSC_HANDLER_FUNC(proto_osc_tilt_handler) {
+	SELF_FROM(user_data);
+	monome_event_t tilt, *e;
+
+	tilt.event_type  = MONOME_TILT;
+	tilt.tilt.sensor = argv[0]->i;
+	tilt.tilt.x      = argv[1]->i;
+	tilt.tilt.y      = argv[2]->i;
+	tilt.tilt.z      = argv[3]->i;
+
+	if( !monome_tilt_filter(&self->parent, &tilt) )
+		return 0;
+
+	if( !(e = proto_osc_queue_push(self)) )
+		return 0;
+
+	e->event_type = tilt.event_type;
+	e->tilt       = tilt.tilt;
+
 	return 0;
 }
 
+/**
+ * message encoding
+ */
+
+static void osc_put_int32(uint8_t *p, int32_t v) {
+	uint32_t u = v;
+
+	p[0] = u >> 24;
+	p[1] = u >> 16;
+	p[2] = u >> 8;
+	p[3] = u;
+}
+
+/* osc strings are nul-terminated and padded out to a multiple of 4 bytes */
+static size_t osc_string_len(size_t len) {
+	return (len + 4) & ~3;
+}
+
+static int osc_template_init(osc_template_t *t, const char *prefix,
+                             const char *path, uint_t argc) {
+	size_t path_len, types_len;
+	char *types;
+
+	path_len  = osc_string_len(strlen(prefix) + 1 + strlen(path));
+	types_len = osc_string_len(1 + argc);
+
+	t->argc = argc;
+	t->len  = path_len + types_len + (argc * 4);
+
+	if( !(t->data = m_calloc(1, t->len)) )
+		return -1;
+
+	sprintf((char *) t->data, "%s/%s", prefix, path);
+
+	types = (char *) t->data + path_len;
+	types[0] = ',';
+	memset(types + 1, 'i', argc);
+
+	return 0;
+}
+
+static void osc_template_free(osc_template_t *t) {
+	m_free(t->data);
+	t->data = NULL;
+}
+
+static void osc_template_put(osc_template_t *t, uint_t arg, int32_t v) {
+	osc_put_int32(t->data + t->len - ((t->argc - arg) * 4), v);
+}
+
+/**
+ * output
+ */
+
+static int proto_osc_sendto(monome_osc_t *self, const uint8_t *buf,
+                            size_t len) {
+	ssize_t ret;
+
+	ret = sendto(self->parent.fd, (const void *) buf, len, 0,
+	             (struct sockaddr *) &self->dest, self->dest_len);
+
+	if( ret < 0 )
+		perror("libmonome: error sending osc message");
+	else {
+		self->parent.io.writes++;
+		self->parent.io.bytes_written += ret;
+	}
+
+	return ret;
+}
+
+static int proto_osc_flush(monome_t *monome) {
+	SELF_FROM(monome);
+	int ret;
+
+	if( !self->bundle_len )
+		return 0;
+
+	ret = proto_osc_sendto(self, self->bundle, self->bundle_len);
+	self->bundle_len = 0;
+
+	return (ret < 0) ? -1 : 0;
+}
+
+static int proto_osc_batch_message(monome_osc_t *self, const uint8_t *msg,
+                                   size_t len) {
+	/* each bundle element is prefixed with its size */
+	if( self->bundle_len + 4 + len > self->bundle_max
+		&& proto_osc_flush(&self->parent) < 0 )
+		return -1;
+
+	if( !self->bundle_len ) {
+		memcpy(self->bundle, "#bundle", 8);
+
+		osc_put_int32(&self->bundle[8], self->timetag.sec);
+		osc_put_int32(&self->bundle[12], self->timetag.frac);
+
+		self->bundle_len = OSC_BUNDLE_HEADER_LEN;
+	}
+
+	osc_put_int32(&self->bundle[self->bundle_len], len);
+	memcpy(&self->bundle[self->bundle_len + 4], msg, len);
+
+	self->bundle_len += 4 + len;
+	return 0;
+}
+
+static int proto_osc_send(monome_osc_t *self, const uint8_t *msg, size_t len) {
+	if( (self->batching || self->scheduling)
+		&& len <= self->bundle_max - OSC_BUNDLE_HEADER_LEN - 4 )
+		return proto_osc_batch_message(self, msg, len);
+
+	return proto_osc_sendto(self, msg, len);
+}
+
+static int proto_osc_send_template(monome_osc_t *self, osc_template_t *t,
+                                   const int32_t *argv) {
+	uint_t i;
+
+	for( i = 0; i < t->argc; i++ )
+		osc_template_put(t, i, argv[i]);
+
+	return proto_osc_send(self, t->data, t->len);
+}
+
+static int proto_osc_batch(monome_t *monome, uint_t enable) {
+	SELF_FROM(monome);
+
+	self->batching = enable;
+
+	if( !enable )
+		return proto_osc_flush(monome);
+
+	return 0;
+}
+
+/* when is on the m_time_usec() clock, timetags are ntp wall-clock time */
+static void proto_osc_timetag_at(lo_timetag *tt, uint64_t when) {
+	uint64_t now, frac;
+
+	now = m_time_usec();
+
+	if( when <= now ) {
+		*tt = LO_TT_IMMEDIATE;
+		return;
+	}
+
+	lo_timetag_now(tt);
+	when -= now;
+
+	frac = tt->frac + (((when % 1000000) << 32) / 1000000);
+
+	tt->sec += (when / 1000000) + (frac >> 32);
+	tt->frac = (uint32_t) frac;
+}
+
+/* the receiving end holds on to timetagged bundles until they're due, so
+   all we do is send everything in between as bundles with the deadline */
+static int proto_osc_schedule_begin(monome_t *monome, uint64_t when) {
+	SELF_FROM(monome);
+
+	if( self->scheduling || proto_osc_flush(monome) < 0 )
+		return -1;
+
+	proto_osc_timetag_at(&self->timetag, when);
+	self->scheduling = 1;
+
+	return 0;
+}
+
+static int proto_osc_schedule_end(monome_t *monome) {
+	SELF_FROM(monome);
+	int ret;
+
+	if( !self->scheduling )
+		return -1;
+
+	ret = proto_osc_flush(monome);
+
+	self->scheduling = 0;
+	self->timetag = LO_TT_IMMEDIATE;
+
+	return ret;
+}
+
+static monome_output_functions_t proto_osc_output_functions = {
+	.batch = proto_osc_batch,
+	.flush = proto_osc_flush,
+
+	.schedule_begin = proto_osc_schedule_begin,
+	.schedule_end = proto_osc_schedule_end
+};
+
 /**
  * led functions
  */
 
 static int proto_osc_led_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(led_set, "iii", x, y, !!on);
+	return OSC_SEND(led_set, x, y, !!on);
 }
 
 static int proto_osc_led_all(monome_t *monome, uint_t status) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(led_all, "i", status);
+	return OSC_SEND(led_all, status);
 }
 
 static int proto_osc_led_row(monome_t *monome, uint_t x_off, uint_t y,
@@ -113,9 +373,9 @@ static int proto_osc_led_row(monome_t *monome, uint_t x_off, uint_t y,
 	SELF_FROM(monome);
 
 	if( count == 1 )
-		return LO_SEND_MSG(led_row, "iii", x_off, y, data[0]);
+		return OSC_SEND(led_row[0], x_off, y, data[0]);
 
-	return LO_SEND_MSG(led_row, "iiii", x_off, y, data[0], data[1]);
+	return OSC_SEND(led_row[1], x_off, y, data[0], data[1]);
 }
 
 static int proto_osc_led_col(monome_t *monome, uint_t x, uint_t y_off,
@@ -123,22 +383,22 @@ static int proto_osc_led_col(monome_t *monome, uint_t x, uint_t y_off,
 	SELF_FROM(monome);
 
 	if( count == 1 )
-		return LO_SEND_MSG(led_col, "iii", x, y_off, data[0]);
+		return OSC_SEND(led_col[0], x, y_off, data[0]);
 
-	return LO_SEND_MSG(led_col, "iiii", x, y_off, data[0], data[1]);
+	return OSC_SEND(led_col[1], x, y_off, data[0], data[1]);
 }
 
 static int proto_osc_led_map(monome_t *monome, uint_t x_off, uint_t y_off,
                              const uint8_t *f) {
 	SELF_FROM(monome);
 
-	return LO_SEND_MSG(led_map, "iiiiiiiiii", x_off, y_off,
-	                   f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]);
+	return OSC_SEND(led_map, x_off, y_off,
+	                f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]);
 }
 
 static int proto_osc_led_intensity(monome_t *monome, uint_t brightness) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(led_intensity, "i", brightness);
+	return OSC_SEND(led_intensity, brightness);
 }
 
 static monome_led_functions_t proto_osc_led_functions = {
@@ -150,6 +410,89 @@ static monome_led_functions_t proto_osc_led_functions = {
 	.intensity = proto_osc_led_intensity
 };
 
+/**
+ * led level functions
+ */
+
+static int proto_osc_led_level_set(monome_t *monome, uint_t x, uint_t y,
+                                   uint_t level) {
+	SELF_FROM(monome);
+	return OSC_SEND(led_level_set, x, y, level);
+}
+
+static int proto_osc_led_level_all(monome_t *monome, uint_t level) {
+	SELF_FROM(monome);
+	return OSC_SEND(led_level_all, level);
+}
+
+static int proto_osc_led_level_map(monome_t *monome, uint_t x_off,
+                                   uint_t y_off, const uint8_t *data) {
+	SELF_FROM(monome);
+	osc_template_t *t = &self->led_level_map;
+	uint_t i;
+
+	osc_template_put(t, 0, x_off);
+	osc_template_put(t, 1, y_off);
+	for( i = 0; i < 64; i++ )
+		osc_template_put(t, i + 2, data[i]);
+
+	return proto_osc_send(self, t->data, t->len);
+}
+
+/* like mext, rows and columns go out 8 levels at a time */
+static int proto_osc_led_level_row_col(monome_osc_t *self, osc_template_t *t,
+                                       uint_t x, uint_t y, const uint8_t *data) {
+	uint_t i;
+
+	osc_template_put(t, 0, x);
+	osc_template_put(t, 1, y);
+	for( i = 0; i < 8; i++ )
+		osc_template_put(t, i + 2, data[i]);
+
+	return proto_osc_send(self, t->data, t->len);
+}
+
+static int proto_osc_led_level_row(monome_t *monome, uint_t x_off, uint_t y,
+                                   size_t count, const uint8_t *data) {
+	SELF_FROM(monome);
+	int ret, total = 0;
+
+	/* like the other senders, the bytes sent (0 while batching) */
+	for( count >>= 3; count--; x_off += 8, data += 8 ) {
+		if( (ret = proto_osc_led_level_row_col(self, &self->led_level_row,
+		                                       x_off, y, data)) < 0 )
+			return -1;
+
+		total += ret;
+	}
+
+	return total;
+}
+
+static int proto_osc_led_level_col(monome_t *monome, uint_t x, uint_t y_off,
+                                   size_t count, const uint8_t *data) {
+	SELF_FROM(monome);
+	int ret, total = 0;
+
+	for( count >>= 3; count--; y_off += 8, data += 8 ) {
+		if( (ret = proto_osc_led_level_row_col(self, &self->led_level_col,
+		                                       x, y_off, data)) < 0 )
+			return -1;
+
+		total += ret;
+	}
+
+	return total;
+}
+
+static monome_led_level_functions_t proto_osc_led_level_functions = {
+	.set = proto_osc_led_level_set,
+	.all = proto_osc_led_level_all,
+	.map = proto_osc_led_level_map,
+	.row = proto_osc_led_level_row,
+	.col = proto_osc_led_level_col
+};
+
 /**
  * led ring functions
  */
@@ -157,44 +500,64 @@ static monome_led_functions_t proto_osc_led_functions = {
 static int proto_osc_led_ring_set(monome_t *monome, uint_t ring, uint_t led,
                                   uint_t level) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(ring_set, "iii", ring, led, level);
+	return OSC_SEND(ring_set, ring, led, level);
 }
 
 static int proto_osc_led_ring_all(monome_t *monome, uint_t ring,
                                   uint_t level) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(ring_all, "ii", ring, level);
+	return OSC_SEND(ring_all, ring, level);
 }
 
 static int proto_osc_led_ring_map(monome_t *monome, uint_t ring,
                                   const uint8_t *levels) {
 	SELF_FROM(monome);
-	lo_message m;
-	int i, ret;
+	osc_template_t *t = &self->ring_map;
+	uint_t i;
 
-	m = lo_message_new();
-
-	lo_message_add_int32(m, ring);
+	osc_template_put(t, 0, ring);
 	for( i = 0; i < 64; i++ )
-		lo_message_add_int32(m, levels[i]);
-
-	ret = lo_send_message_from(self->outgoing, self->server, self->ring_map_str, m);
-	lo_message_free(m);
+		osc_template_put(t, i + 1, levels[i]);
 
-	return ret;
+	return proto_osc_send(self, t->data, t->len);
 }
 
 static int proto_osc_led_ring_range(monome_t *monome, uint_t ring,
                                     uint_t start, uint_t end, uint_t level) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(ring_range, "iiii", ring, start, end, level);
+	return OSC_SEND(ring_range, ring, start, end, level);
+}
+
+static int proto_osc_led_ring_intensity(monome_t *monome, uint_t brightness) {
+	SELF_FROM(monome);
+	return OSC_SEND(ring_intensity, brightness);
 }
 
 static monome_led_ring_functions_t proto_osc_led_ring_functions = {
 	.set = proto_osc_led_ring_set,
 	.all = proto_osc_led_ring_all,
 	.map = proto_osc_led_ring_map,
-	.range = proto_osc_led_ring_range
+	.range = proto_osc_led_ring_range,
+	.intensity = proto_osc_led_ring_intensity
+};
+
+/**
+ * tilt functions
+ */
+
+static int proto_osc_tilt_enable(monome_t *monome, uint_t sensor) {
+	SELF_FROM(monome);
+	return OSC_SEND(tilt_set, sensor, 1);
+}
+
+static int proto_osc_tilt_disable(monome_t *monome, uint_t sensor) {
+	SELF_FROM(monome);
+	return OSC_SEND(tilt_set, sensor, 0);
+}
+
+static monome_tilt_functions_t proto_osc_tilt_functions = {
+	.enable = proto_osc_tilt_enable,
+	.disable = proto_osc_tilt_disable
 };
 
 /**
@@ -204,35 +567,208 @@ static monome_led_ring_functions_t proto_osc_led_ring_functions = {
 static int proto_osc_next_event(monome_t *monome, monome_event_t *e) {
 	SELF_FROM(monome);
 
-	self->e_ptr = e;
-	self->have_event = 0;
+	/* read everything that's waiting on the socket rather than one
+	   datagram per wakeup. the handlers queue up whatever they find. */
+	while( OSC_EVENT_QUEUE_LEN - proto_osc_queued(self) >= OSC_EVENT_QUEUE_SLACK
+	       && lo_server_recv_noblock(self->server, 0) > 0 )
+		;
 
-	lo_server_recv_noblock(self->server, 0);
+	if( !proto_osc_queued(self) )
+		return 0;
 
-	return self->have_event;
+	*e = self->queue.events[self->queue.head++ & (OSC_EVENT_QUEUE_LEN - 1)];
+	return 1;
+}
+
+static int proto_osc_pending(monome_t *monome) {
+	SELF_FROM(monome);
+	return !!proto_osc_queued(self);
+}
+
+static int proto_osc_resolve_unix_dest(monome_osc_t *self, const char *url) {
+#if defined(_WIN32)
+	fprintf(stderr, "libmonome: osc.unix:// is not supported on windows\n");
+	return -1;
+#else
+	struct sockaddr_un *addr = (struct sockaddr_un *) &self->dest;
+	char *path;
+
+	if( !(path = lo_url_get_path(url)) )
+		return -1;
+
+	if( strlen(path) >= sizeof(addr->sun_path) ) {
+		fprintf(stderr, "libmonome: osc socket path too long: %s\n", path);
+		m_free(path);
+		return -1;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+
+	self->dest_len = sizeof(*addr);
+
+	m_free(path);
+	return 0;
+#endif
+}
+
+/* outgoing messages go out through the server's socket (so that replies
+   come back to it), which means the destination has to be in its family */
+static int proto_osc_resolve_dest(monome_osc_t *self, const char *url) {
+	struct sockaddr_storage local;
+	struct addrinfo hints, *res;
+	socklen_t local_len;
+	int err;
+
+	if( self->unix_socket )
+		return proto_osc_resolve_unix_dest(self, url);
+
+	local_len = sizeof(local);
+	if( getsockname(self->parent.fd, (struct sockaddr *) &local,
+	                &local_len) < 0 )
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = local.ss_family;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if( local.ss_family == AF_INET6 )
+		hints.ai_flags = AI_V4MAPPED;
+
+	err = getaddrinfo(lo_address_get_hostname(self->outgoing),
+	                  lo_address_get_port(self->outgoing), &hints, &res);
+
+	if( err ) {
+		fprintf(stderr, "libmonome: could not resolve osc destination: %s\n",
+		        gai_strerror(err));
+		return -1;
+	}
+
+	memcpy(&self->dest, res->ai_addr, res->ai_addrlen);
+	self->dest_len = res->ai_addrlen;
+
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int proto_osc_url_is_stream(const char *url) {
+	char *proto;
+	int stream;
+
+	if( !(proto = lo_url_get_protocol(url)) )
+		return 0;
+
+	stream = !!strcmp(proto, "udp");
+	m_free(proto);
+
+	return stream;
+}
+
+/* splits "?prefix=/foo&buffer=262144" off the end of the url, which liblo
+   wouldn't understand. returns the bare url, which the caller frees. */
+static char *proto_osc_parse_options(const char *dev, char **prefix,
+                                     int *buffer) {
+	char *url, *opt, *next;
+
+	*prefix = NULL;
+	*buffer = 0;
+
+	if( !(url = m_strdup(dev)) )
+		return NULL;
+
+	if( !(opt = strchr(url, '?')) )
+		return url;
+
+	for( *opt++ = '\0'; opt; opt = next ) {
+		if( (next = strchr(opt, '&')) )
+			*next++ = '\0';
+
+		if( !strncmp(opt, "prefix=", 7) ) {
+			m_free(*prefix);
+			*prefix = m_strdup(opt + 7);
+		} else if( !strncmp(opt, "buffer=", 7) )
+			*buffer = atoi(opt + 7);
+		else
+			fprintf(stderr, "libmonome: unknown osc option \"%s\"\n", opt);
+	}
+
+	return url;
 }
 
 static int proto_osc_open(monome_t *monome, const char *dev,
 						  const char *serial, const monome_devmap_t *m,
 						  va_list args) {
 	SELF_FROM(monome);
-	char *port, *buf;
+	char *port, *buf, *url, *prefix;
+	int sockbuf;
 
+	/* for osc.unix:// this is the path of our own socket */
 	port = va_arg(args, char *);
 
-	if( !(self->server = lo_server_new(port, proto_osc_lo_error)) )
+	if( !(url = proto_osc_parse_options(dev, &prefix, &sockbuf)) )
+		return 1;
+
+	self->unix_socket = !strncmp(url, "osc.unix://", 11);
+
+	/* we send from the server's own datagram socket, so anything liblo
+	   would have to open a connection for (osc.tcp://) is out */
+	if( !self->unix_socket && proto_osc_url_is_stream(url) ) {
+		fprintf(stderr, "libmonome: only osc.udp:// and osc.unix:// urls "
+		        "are supported\n");
+		m_free(prefix);
+		m_free(url);
+		return 1;
+	}
+
+	if( self->unix_socket ) {
+		self->server = lo_server_new_with_proto(port, LO_UNIX,
+		                                        proto_osc_lo_error);
+		self->bundle_max = OSC_UNIX_MAX_BUNDLE_LEN;
+	} else {
+		self->server = lo_server_new(port, proto_osc_lo_error);
+		self->bundle_max = OSC_MAX_BUNDLE_LEN;
+	}
+
+	if( !self->server ) {
+		m_free(prefix);
+		m_free(url);
 		return 1;
+	}
 
-	self->prefix   = lo_url_get_path(dev);
-	self->outgoing = lo_address_new_from_url(dev);
+	/* the path of a unix url is the socket, so the prefix can only come
+	   from the options there */
+	if( prefix )
+		self->prefix = prefix;
+	else if( self->unix_socket )
+		self->prefix = m_strdup("/monome");
+	else
+		self->prefix = lo_url_get_path(url);
 
-	if( (monome->fd = lo_server_get_socket_fd(self->server)) < 0 ) {
+	self->outgoing = lo_address_new_from_url(url);
+
+	if( !self->prefix || !self->outgoing
+		|| (monome->fd = lo_server_get_socket_fd(self->server)) < 0
+		|| proto_osc_resolve_dest(self, url) ) {
+		m_free(url);
 		proto_osc_close(monome);
 		proto_osc_free(monome);
 		return 1;
 	}
 
-	lo_send_from(self->outgoing, self->server, LO_TT_IMMEDIATE, "/sys/port","i",atoi(port));
+	m_free(url);
+
+	if( sockbuf > 0 ) {
+		setsockopt(monome->fd, SOL_SOCKET, SO_SNDBUF,
+		           (const void *) &sockbuf, sizeof(sockbuf));
+		setsockopt(monome->fd, SOL_SOCKET, SO_RCVBUF,
+		           (const void *) &sockbuf, sizeof(sockbuf));
+	}
+
+	/* a unix datagram already carries our address, there's no port to
+	   announce */
+	if( !self->unix_socket )
+		lo_send_from(self->outgoing, self->server, LO_TT_IMMEDIATE, "/sys/port","i",atoi(port));
 #define ASPRINTF_OR_BAIL(...) do { \
 	if (asprintf(__VA_ARGS__) < 0) \
 		return -1;                 \
@@ -250,44 +786,95 @@ static int proto_osc_open(monome_t *monome, const char *dev,
 	lo_server_add_method(self->server, buf, "ii", proto_osc_enc_key_handler, self);
 	m_free(buf);
 
-#define CACHE_OSC_PATH(base, path) ASPRINTF_OR_BAIL(&self->base##_str, "%s/" path, self->prefix)
-	CACHE_OSC_PATH(led_set, "grid/led/set");
-	CACHE_OSC_PATH(led_all, "grid/led/all");
-	CACHE_OSC_PATH(led_map, "grid/led/map");
-	CACHE_OSC_PATH(led_col, "grid/led/col");
-	CACHE_OSC_PATH(led_row, "grid/led/row");
-	CACHE_OSC_PATH(led_intensity, "grid/led/intensity");
-
-	CACHE_OSC_PATH(ring_set, "ring/set");
-	CACHE_OSC_PATH(ring_all, "ring/all");
-	CACHE_OSC_PATH(ring_map, "ring/map");
-	CACHE_OSC_PATH(ring_range, "ring/range");
-#undef CACHE_OSC_PATH
+	ASPRINTF_OR_BAIL(&buf, "%s/tilt", self->prefix);
+	lo_server_add_method(self->server, buf, "iiii", proto_osc_tilt_handler, self);
+	m_free(buf);
+
+#define OSC_TEMPLATE(base, path, argc) do {                      \
+	if( osc_template_init(&self->base, self->prefix, path, argc) ) \
+		return -1;                                                 \
+	} while (0)
+	OSC_TEMPLATE(led_set, "grid/led/set", 3);
+	OSC_TEMPLATE(led_all, "grid/led/all", 1);
+	OSC_TEMPLATE(led_map, "grid/led/map", 10);
+	OSC_TEMPLATE(led_col[0], "grid/led/col", 3);
+	OSC_TEMPLATE(led_col[1], "grid/led/col", 4);
+	OSC_TEMPLATE(led_row[0], "grid/led/row", 3);
+	OSC_TEMPLATE(led_row[1], "grid/led/row", 4);
+	OSC_TEMPLATE(led_intensity, "grid/led/intensity", 1);
+
+	OSC_TEMPLATE(led_level_set, "grid/led/level/set", 3);
+	OSC_TEMPLATE(led_level_all, "grid/led/level/all", 1);
+	OSC_TEMPLATE(led_level_map, "grid/led/level/map", 66);
+	OSC_TEMPLATE(led_level_row, "grid/led/level/row", 10);
+	OSC_TEMPLATE(led_level_col, "grid/led/level/col", 10);
+
+	OSC_TEMPLATE(ring_set, "ring/set", 3);
+	OSC_TEMPLATE(ring_all, "ring/all", 2);
+	OSC_TEMPLATE(ring_map, "ring/map", 65);
+	OSC_TEMPLATE(ring_range, "ring/range", 4);
+	OSC_TEMPLATE(ring_intensity, "ring/intensity", 1);
+
+	OSC_TEMPLATE(tilt_set, "tilt/set", 2);
+#undef OSC_TEMPLATE
 #undef ASPRINTF_OR_BAIL
 
+	/* row and col messages carry 8 leds per byte (or level message) */
+	self->led_costs = (monome_led_costs_t) {
+		.set       = self->led_set.len,
+		.all       = self->led_all.len,
+		.map       = self->led_map.len,
+		.row       = self->led_row[0].len,
+		.col       = self->led_col[0].len,
+		.level_set = self->led_level_set.len,
+		.level_all = self->led_level_all.len,
+		.level_map = self->led_level_map.len,
+		.level_row = self->led_level_row.len,
+		.level_col = self->led_level_col.len
+	};
+
+	monome->led_costs = &self->led_costs;
+
+	/* the size comes back as /sys/size, which is all the framebuffer is
+	   waiting for */
+	lo_server_add_method(self->server, "/sys/size", "ii",
+	                     proto_osc_size_handler, self);
+	lo_send_from(self->outgoing, self->server, LO_TT_IMMEDIATE, "/sys/info", "");
+
 	return 0;
 }
 
 static int proto_osc_close(monome_t *monome) {
-	return 0;
+	return proto_osc_flush(monome);
 }
 
 static void proto_osc_free(monome_t *monome) {
 	SELF_FROM(monome);
 
-#define clear_osc_path(base) m_free(self->base##_str);
-	clear_osc_path(led_set);
-	clear_osc_path(led_all);
-	clear_osc_path(led_map);
-	clear_osc_path(led_col);
-	clear_osc_path(led_row);
-	clear_osc_path(led_intensity);
-
-	clear_osc_path(ring_set);
-	clear_osc_path(ring_all);
-	clear_osc_path(ring_map);
-	clear_osc_path(ring_range);
-#undef clear_osc_path
+#define clear_osc_template(base) osc_template_free(&self->base);
+	clear_osc_template(led_set);
+	clear_osc_template(led_all);
+	clear_osc_template(led_map);
+	clear_osc_template(led_col[0]);
+	clear_osc_template(led_col[1]);
+	clear_osc_template(led_row[0]);
+	clear_osc_template(led_row[1]);
+	clear_osc_template(led_intensity);
+
+	clear_osc_template(led_level_set);
+	clear_osc_template(led_level_all);
+	clear_osc_template(led_level_map);
+	clear_osc_template(led_level_row);
+	clear_osc_template(led_level_col);
+
+	clear_osc_template(ring_set);
+	clear_osc_template(ring_all);
+	clear_osc_template(ring_map);
+	clear_osc_template(ring_range);
+	clear_osc_template(ring_intensity);
+
+	clear_osc_template(tilt_set);
+#undef clear_osc_template
 
 	m_free(self->prefix);
 	lo_server_free(self->server);
@@ -316,10 +903,15 @@ monome_t *monome_protocol_new(void) {
 	monome->free       = proto_osc_free;
 
 	monome->next_event = proto_osc_next_event;
+	monome->pending    = proto_osc_pending;
 
 	monome->led = &proto_osc_led_functions;
-	monome->led_level = NULL;
+	monome->led_level = &proto_osc_led_level_functions;
 	monome->led_ring = &proto_osc_led_ring_functions;
+	monome->tilt = &proto_osc_tilt_functions;
+	monome->output = &proto_osc_output_functions;
+
+	self->timetag = LO_TT_IMMEDIATE;
 
 	return monome;
 }
@@ -14,12 +14,51 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 #include <lo/lo.h>
 
 #include "monome.h"
 #include "internal.h"
 
 typedef struct monome_osc monome_osc_t;
+typedef struct osc_template osc_template_t;
+
+/* largest bundle we'll put in a single udp datagram without it being
+   fragmented on an ethernet-sized mtu */
+#define OSC_MAX_BUNDLE_LEN 1472
+
+/* unix datagrams don't fragment, so can be a good deal larger */
+#define OSC_UNIX_MAX_BUNDLE_LEN 8192
+
+/* the most a single datagram can carry, and the smallest bundle element
+   that turns into an event: a size word, "/enc/key" or "/grid/key" with an
+   empty prefix padded to 12 bytes, ",ii" padded to 4 and two arguments. */
+#define OSC_MAX_DATAGRAM_LEN 65536
+#define OSC_MIN_EVENT_LEN    (4 + 12 + 4 + 8)
+
+/* we only read another datagram from the socket while a whole one's worth
+   of events fits in the queue, so that a bundle is never cut short */
+#define OSC_EVENT_QUEUE_SLACK ((OSC_MAX_DATAGRAM_LEN / OSC_MIN_EVENT_LEN) + 1)
+
+/* must be a power of two, and comfortably more than the slack */
+#define OSC_EVENT_QUEUE_LEN 4096
+
+/* an osc message with only int32 arguments. the path and type tags are
+   encoded once, then the argument words at the end are patched in place
+   for every send. */
+struct osc_template {
+	uint8_t *data;
+	size_t len;
+	uint_t argc;
+};
 
 struct monome_osc {
 	monome_t parent;
@@ -28,18 +67,49 @@ struct monome_osc {
 	lo_address outgoing;
 	char *prefix;
 
-	int have_event;
-	monome_event_t *e_ptr;
+	/* outgoing messages are sent straight from the server's socket */
+	struct sockaddr_storage dest;
+	socklen_t dest_len;
+
+	/* osc.unix:// rather than osc.udp:// */
+	int unix_socket;
+
+	/* events parsed from incoming datagrams, waiting for next_event().
+	   head and tail only ever count up. */
+	struct {
+		monome_event_t events[OSC_EVENT_QUEUE_LEN];
+		uint_t head, tail;
+	} queue;
+
+	/* led messages waiting for proto_osc_flush() while batching or
+	   scheduling, already encoded as a bundle */
+	int batching;
+	int scheduling;
+	lo_timetag timetag;
+	size_t bundle_len, bundle_max;
+	uint8_t bundle[OSC_UNIX_MAX_BUNDLE_LEN];
+
+	osc_template_t led_set;
+	osc_template_t led_all;
+	osc_template_t led_map;
+	osc_template_t led_col[2];
+	osc_template_t led_row[2];
+	osc_template_t led_intensity;
+
+	osc_template_t led_level_set;
+	osc_template_t led_level_all;
+	osc_template_t led_level_map;
+	osc_template_t led_level_row;
+	osc_template_t led_level_col;
+
+	osc_template_t ring_set;
+	osc_template_t ring_all;
+	osc_template_t ring_map;
+	osc_template_t ring_range;
+	osc_template_t ring_intensity;
 
-	char *led_set_str;
-	char *led_all_str;
-	char *led_map_str;
-	char *led_col_str;
-	char *led_row_str;
-	char *led_intensity_str;
+	osc_template_t tilt_set;
 
-	char *ring_set_str;
-	char *ring_all_str;
-	char *ring_map_str;
-	char *ring_range_str;
+	/* what each message costs in bytes, for the framebuffer */
+	monome_led_costs_t led_costs;
 };
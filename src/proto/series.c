@@ -24,6 +24,8 @@
 #include "platform.h"
 #include "rotation.h"
 #include "monobright.h"
+#include "keystate.h"
+#include "tilt.h"
 
 #include "series.h"
 
@@ -39,6 +41,68 @@ static int monome_write(monome_t *monome, const uint8_t *buf,
 	return -1;
 }
 
+/* keep the shadow in step with everything else that's sent. coordinates
+   are the device's own. */
+
+static void shadow_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
+	uint16_t *row = &SERIES_T(monome)->shadow.rows[y & 0x0F];
+
+	*row = (*row & ~(1 << x)) | (!!on << x);
+}
+
+static void shadow_col(monome_t *monome, uint_t x, uint_t data) {
+	uint_t y;
+
+	for( y = 0; y < 16; y++ )
+		shadow_set(monome, x, y, data & (1 << y));
+}
+
+static void shadow_line(monome_t *monome, const uint8_t *buf) {
+	uint16_t *rows = SERIES_T(monome)->shadow.rows;
+	uint_t address = buf[0] & 0x0F;
+
+	switch( buf[0] & 0xF0 ) {
+	case PROTO_SERIES_LED_ROW_8:
+		rows[address] = (rows[address] & 0xFF00) | buf[1];
+		break;
+
+	case PROTO_SERIES_LED_ROW_16:
+		rows[address] = buf[1] | (buf[2] << 8);
+		break;
+
+	case PROTO_SERIES_LED_COL_8:
+		shadow_col(monome, address, buf[1]);
+		break;
+
+	case PROTO_SERIES_LED_COL_16:
+		shadow_col(monome, address, buf[1] | (buf[2] << 8));
+		break;
+	}
+}
+
+static void shadow_quadrant(monome_t *monome, uint_t quadrant,
+                            const uint8_t *data) {
+	uint16_t *rows = &SERIES_T(monome)->shadow.rows[(quadrant >> 1) * 8];
+	uint_t shift = (quadrant & 1) * 8;
+	uint_t i;
+
+	for( i = 0; i < 8; i++ )
+		rows[i] = (rows[i] & ~(0xFF << shift)) | (data[i] << shift);
+
+	SERIES_T(monome)->shadow.known |= 1 << quadrant;
+}
+
+/* for led writes. if one fails we can't tell what the device got, so the
+   shadow can't be trusted until everything has been sent again. */
+static int shadow_write(monome_t *monome, const uint8_t *buf,
+                        ssize_t bufsize) {
+	if( !monome_write(monome, buf, bufsize) )
+		return 0;
+
+	SERIES_T(monome)->shadow.known = 0;
+	return -1;
+}
+
 static int proto_series_led_col_row_8(monome_t *monome,
                                       proto_series_message_t mode,
                                       uint_t address, const uint8_t *data) {
@@ -85,8 +149,9 @@ static int proto_series_led_col_row_8(monome_t *monome,
 		mode = (!(mode - PROTO_SERIES_LED_ROW_8) << 4) + PROTO_SERIES_LED_ROW_8;
 
 	buf[0] = mode | (address & 0x0F );
+	shadow_line(monome, buf);
 
-	return monome_write(monome, buf, sizeof(buf));
+	return shadow_write(monome, buf, sizeof(buf));
 }
 
 static int proto_series_led_col_row_16(monome_t *monome, proto_series_message_t mode, uint_t address, const uint8_t *data) {
@@ -152,8 +217,9 @@ static int proto_series_led_col_row_16(monome_t *monome, proto_series_message_t
 		mode = (!(mode - PROTO_SERIES_LED_ROW_16) << 4) + PROTO_SERIES_LED_ROW_16;
 
 	buf[0] = mode | (address & 0x0F );
+	shadow_line(monome, buf);
 
-	return monome_write(monome, buf, sizeof(buf));
+	return shadow_write(monome, buf, sizeof(buf));
 }
 
 /**
@@ -161,8 +227,16 @@ static int proto_series_led_col_row_16(monome_t *monome, proto_series_message_t
  */
 
 static int proto_series_led_all(monome_t *monome, uint_t status) {
+	series_t *series = SERIES_T(monome);
 	uint8_t buf = PROTO_SERIES_CLEAR | (status & 0x01);
-	return monome_write(monome, &buf, sizeof(buf));
+	uint_t y;
+
+	for( y = 0; y < 16; y++ )
+		series->shadow.rows[y] = (status & 0x01) ? (1 << monome->cols) - 1 : 0;
+
+	series->shadow.known = 0x0F;
+
+	return shadow_write(monome, &buf, sizeof(buf));
 }
 
 static int proto_series_led_intensity(monome_t *monome, uint_t brightness) {
@@ -174,11 +248,12 @@ static int proto_series_led_set(monome_t *monome, uint_t x, uint_t y, uint_t on)
 	uint8_t buf[2];
 
 	ROTATE_COORDS(monome, x, y);
+	shadow_set(monome, x, y, on);
 
 	buf[0] = PROTO_SERIES_LED_ON + (!on << 4);
 	buf[1] = (x << 4) | y;
 
-	return monome_write(monome, buf, sizeof(buf));
+	return shadow_write(monome, buf, sizeof(buf));
 }
 
 static int proto_series_led_col(monome_t *monome, uint_t x, uint_t y_off,
@@ -231,20 +306,230 @@ static int proto_series_led_row(monome_t *monome, uint_t x_off, uint_t y,
 	return -1;
 }
 
-static int proto_series_led_map(monome_t *monome, uint_t x_off, uint_t y_off,
-                                const uint8_t *data) {
+/* data is already in the device's orientation */
+static int proto_series_write_map(monome_t *monome, uint_t x_off,
+                                  uint_t y_off, const uint8_t *data) {
 	uint8_t buf[9];
 	uint_t quadrant;
 
 	memcpy(&buf[1], data, 8);
-	ROTSPEC(monome).map_cb(monome, &buf[1]);
 
 	ROTATE_COORDS(monome, x_off, y_off);
 	quadrant = (x_off / 8) + ((y_off / 8) * 2);
 
 	buf[0] = PROTO_SERIES_LED_FRAME | (quadrant & 0x03);
+	shadow_quadrant(monome, quadrant & 0x03, data);
 
-	return monome_write(monome, buf, sizeof(buf));
+	return shadow_write(monome, buf, sizeof(buf));
+}
+
+static int proto_series_led_map(monome_t *monome, uint_t x_off, uint_t y_off,
+                                const uint8_t *data) {
+	uint8_t buf[8];
+
+	memcpy(buf, data, 8);
+	ROTSPEC(monome).map_cb(monome, buf);
+
+	return proto_series_write_map(monome, x_off, y_off, buf);
+}
+
+/**
+ * frame encoder
+ */
+
+static void frame_xlate_update(monome_t *monome) {
+	series_t *series = SERIES_T(monome);
+	uint_t q, x, y;
+
+	for( q = 0; q < 4; q++ ) {
+		x = (q & 1) * 8;
+		y = (q >> 1) * 8;
+
+		/* past the edge on smaller grids, never looked at */
+		if( x >= monome_get_cols(monome) || y >= monome_get_rows(monome) )
+			continue;
+
+		ROTATE_COORDS(monome, x, y);
+		series->frame_xlate.quadrant[q] = (x / 8) + ((y / 8) * 2);
+	}
+
+	series->frame_xlate.rotation = monome->rotation;
+}
+
+/* pack the application's bitmap into whole device rows */
+static void frame_to_device(monome_t *monome, uint16_t *want,
+                            const uint8_t *bits) {
+	series_t *series = SERIES_T(monome);
+	uint_t stride, qx, qy, dq, i;
+	uint8_t quad[8];
+
+	if( series->frame_xlate.rotation != monome->rotation )
+		frame_xlate_update(monome);
+
+	stride = monome_get_cols(monome) / 8;
+	memset(want, 0, sizeof(series->shadow.rows));
+
+	for( qy = 0; qy < monome_get_rows(monome) / 8; qy++ ) {
+		for( qx = 0; qx < stride; qx++ ) {
+			for( i = 0; i < 8; i++ )
+				quad[i] = bits[(((qy * 8) + i) * stride) + qx];
+
+			ROTSPEC(monome).map_cb(monome, quad);
+			dq = series->frame_xlate.quadrant[qx + (qy * 2)];
+
+			for( i = 0; i < 8; i++ )
+				want[((dq >> 1) * 8) + i] |= quad[i] << ((dq & 1) * 8);
+		}
+	}
+}
+
+static int frame_is_uniform(monome_t *monome, const uint16_t *want) {
+	uint16_t full = (1 << monome->cols) - 1;
+	uint_t y;
+
+	if( want[0] && want[0] != full )
+		return 0;
+
+	for( y = 1; y < monome->rows; y++ )
+		if( want[y] != want[0] )
+			return 0;
+
+	return 1;
+}
+
+static uint_t frame_emit_quadrant(monome_t *monome, uint8_t *buf,
+                                  const uint16_t *want, uint_t dq) {
+	series_t *series = SERIES_T(monome);
+	uint16_t *rows = series->shadow.rows;
+	uint_t shift, row_cost, col_cost, nrows, ncols, nleds, y0, i, j, len;
+	uint8_t diff, cols;
+
+	y0 = (dq >> 1) * 8;
+	shift = (dq & 1) * 8;
+	row_cost = (monome->cols > 8) ? 3 : 2;
+	col_cost = (monome->rows > 8) ? 3 : 2;
+
+	for( nrows = nleds = 0, cols = 0, i = 0; i < 8; i++ ) {
+		diff = (want[y0 + i] ^ rows[y0 + i]) >> shift;
+
+		if( diff ) {
+			nrows++;
+			cols |= diff;
+		}
+
+		for( ; diff; diff &= diff - 1 )
+			nleds++;
+	}
+
+	for( ncols = 0, i = 0; i < 8; i++ )
+		ncols += (cols >> i) & 1;
+
+	if( (series->shadow.known & (1 << dq)) && !nrows )
+		return 0;
+
+	row_cost *= nrows;
+	col_cost *= ncols;
+	len = 0;
+
+	/* rows and columns span the whole grid, so they also bring the same
+	   lines in the neighbouring quadrants up to date. */
+	if( !(series->shadow.known & (1 << dq))
+	    || (row_cost >= 9 && col_cost >= 9 && nleds * 2 >= 9) ) {
+		buf[len++] = PROTO_SERIES_LED_FRAME | dq;
+
+		for( i = 0; i < 8; i++ )
+			buf[len++] = want[y0 + i] >> shift;
+
+		shadow_quadrant(monome, dq, &buf[1]);
+	} else if( nleds * 2 < row_cost && nleds * 2 < col_cost ) {
+		for( i = 0; i < 8; i++ ) {
+			diff = (want[y0 + i] ^ rows[y0 + i]) >> shift;
+
+			for( j = 0; j < 8; j++ ) {
+				if( !(diff & (1 << j)) )
+					continue;
+
+				buf[len++] = ((want[y0 + i] >> (shift + j)) & 1)
+					? PROTO_SERIES_LED_ON : PROTO_SERIES_LED_OFF;
+				buf[len++] = ((shift + j) << 4) | (y0 + i);
+			}
+
+			rows[y0 + i] ^= diff << shift;
+		}
+	} else if( row_cost <= col_cost ) {
+		for( i = 0; i < 8; i++ ) {
+			if( !((want[y0 + i] ^ rows[y0 + i]) >> shift & 0xFF) )
+				continue;
+
+			buf[len++] = ((monome->cols > 8)
+				? PROTO_SERIES_LED_ROW_16 : PROTO_SERIES_LED_ROW_8) | (y0 + i);
+			buf[len++] = want[y0 + i] & 0xFF;
+
+			if( monome->cols > 8 )
+				buf[len++] = want[y0 + i] >> 8;
+
+			rows[y0 + i] = want[y0 + i];
+		}
+	} else {
+		for( i = 0; i < 8; i++ ) {
+			uint_t x = shift + i, col = 0;
+
+			if( !(cols & (1 << i)) )
+				continue;
+
+			for( j = 0; j < monome->rows; j++ )
+				col |= ((want[j] >> x) & 1) << j;
+
+			buf[len++] = ((monome->rows > 8)
+				? PROTO_SERIES_LED_COL_16 : PROTO_SERIES_LED_COL_8) | x;
+			buf[len++] = col & 0xFF;
+
+			if( monome->rows > 8 )
+				buf[len++] = col >> 8;
+
+			shadow_col(monome, x, col);
+		}
+	}
+
+	return len;
+}
+
+/* redraws the whole grid in a single write. each device quadrant gets
+   a frame message, or whichever of the row, column or single led messages
+   covering what changed comes to the fewest bytes. */
+static int proto_series_led_frame(monome_t *monome, const uint8_t *bits) {
+	series_t *series = SERIES_T(monome);
+	uint16_t want[16];
+	uint8_t buf[1 + (4 * 9)];
+	uint_t dq, len;
+
+	frame_to_device(monome, want, bits);
+
+	len = 0;
+
+	if( frame_is_uniform(monome, want) ) {
+		if( series->shadow.known == 0x0F
+		    && !memcmp(want, series->shadow.rows,
+		               monome->rows * sizeof(*want)) )
+			return 0;
+
+		buf[len++] = PROTO_SERIES_CLEAR | !!want[0];
+
+		memcpy(series->shadow.rows, want, sizeof(want));
+		series->shadow.known = 0x0F;
+	} else {
+		for( dq = 0; dq < 4; dq++ ) {
+			if( (dq & 1) * 8 >= monome->cols || (dq >> 1) * 8 >= monome->rows )
+				continue;
+
+			len += frame_emit_quadrant(monome, &buf[len], want, dq);
+		}
+	}
+
+	if( !len )
+		return 0;
+
+	return shadow_write(monome, buf, len);
 }
 
 static monome_led_functions_t proto_series_led_functions = {
@@ -253,7 +538,8 @@ static monome_led_functions_t proto_series_led_functions = {
 	.map = proto_series_led_map,
 	.row = proto_series_led_row,
 	.col = proto_series_led_col,
-	.intensity = proto_series_led_intensity
+	.intensity = proto_series_led_intensity,
+	.frame = proto_series_led_frame
 };
 
 /**
@@ -271,45 +557,32 @@ static int proto_series_led_level_all(monome_t *monome, uint_t level) {
 
 static int proto_series_led_level_map(monome_t *monome, uint_t x_off,
 		uint_t y_off, const uint8_t *data) {
-	uint8_t levels[64];
 	uint8_t masks[8];
-	uint_t i;
 
-	/* don't rotate coords here like you would in mext, since rotate happens
-	 * in the call to the normal led_map function
-	 */
-	ROTSPEC(monome).level_map_cb(monome, levels, data);
-
-	/* reduce the level data into a bitmask */
-	for (i = 0; i < 8; ++i) {
-		masks[i] = reduce_levels_to_bitmask(&levels[i * 8]);
-	};
-	return proto_series_led_map(monome, x_off, y_off, masks);
+	/* threshold, pack and rotate in one go */
+	reduce_quadrant_to_bitmask(monome, masks, data);
+	return proto_series_write_map(monome, x_off, y_off, masks);
 }
 
 
 static int proto_series_led_level_row(monome_t *monome, uint_t x_off,
 		uint_t row, size_t count, const uint8_t *data) {
-	uint_t i, chunks;
 	uint8_t masks[16];
+	uint_t chunks;
 
 	chunks = count / 8;
-	for (i = 0; i < chunks; ++i) {
-		masks[i] = reduce_levels_to_bitmask(&data[i*8]);
-	}
+	reduce_levels_to_bitmasks(masks, data, chunks * 8);
 
 	return proto_series_led_row(monome, x_off, row, chunks, masks);
 }
 
 static int proto_series_led_level_col(monome_t *monome, uint_t col,
 		uint_t y_off, size_t count, const uint8_t *data) {
-	uint_t i, chunks;
 	uint8_t masks[16];
+	uint_t chunks;
 
 	chunks = count / 8;
-	for (i = 0; i < chunks; ++i) {
-		masks[i] = reduce_levels_to_bitmask(&data[i*8]);
-	}
+	reduce_levels_to_bitmasks(masks, data, chunks * 8);
 
 	return proto_series_led_col(monome, col, y_off, chunks, masks);
 }
@@ -363,6 +636,8 @@ static int proto_series_next_event(monome_t *monome, monome_event_t *e) {
 		e->grid.x = buf[1] >> 4;
 		e->grid.y = buf[1] & 0x0F;
 
+		monome_keystate_update(monome, e->grid.x, e->grid.y,
+		                       e->event_type == MONOME_BUTTON_DOWN);
 		UNROTATE_COORDS(monome, e->grid.x, e->grid.y);
 		return 1;
 
@@ -379,7 +654,7 @@ tilt_common: /* I SAID SHUT UP */
 		e->tilt.x = SERIES_T(monome)->tilt.x;
 		e->tilt.y = SERIES_T(monome)->tilt.y;
 		e->tilt.z = 0;
-		return 1;
+		return monome_tilt_filter(monome, e);
 
 	case PROTO_SERIES_AUX_INPUT:
 		/* soon */
@@ -397,6 +672,20 @@ static int proto_series_open(monome_t *monome, const char *dev,
 	monome->serial = serial;
 	monome->friendly = m->friendly;
 
+	/* rows and columns are sent whole, 8 or 16 bits wide depending on the
+	   size of the device. */
+	SERIES_T(monome)->led_costs = (monome_led_costs_t) {
+		.set = 2,
+		.all = 1,
+		.map = 9,
+		.row = (monome->cols > 8) ? 3 : 2,
+		.col = (monome->rows > 8) ? 3 : 2,
+
+		.flags = LED_MONOCHROME | LED_LINE_SPANS_GRID
+	};
+
+	monome->led_costs = &SERIES_T(monome)->led_costs;
+
 	return monome_platform_open(monome, m, dev);
 }
 
@@ -430,6 +719,7 @@ monome_t *monome_protocol_new(void) {
 
 	SERIES_T(monome)->tilt.x = 0;
 	SERIES_T(monome)->tilt.y = 0;
+	SERIES_T(monome)->frame_xlate.rotation = -1;
 
 	return monome;
 }
@@ -59,4 +59,21 @@ struct series {
 		int x;
 		int y;
 	} tilt;
+
+	monome_led_costs_t led_costs;
+
+	/* what the device is showing, in its own orientation. bit x of rows[y]
+	   is led (x, y). `known` has one bit per quadrant, numbered the way
+	   PROTO_SERIES_LED_FRAME numbers them, set once all of it has been sent. */
+	struct {
+		uint16_t rows[16];
+		uint8_t known;
+	} shadow;
+
+	/* which device quadrant each of the application's quadrants lands on,
+	   worked out once per rotation. */
+	struct {
+		int rotation;
+		uint8_t quadrant[4];
+	} frame_xlate;
 };
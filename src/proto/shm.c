@@ -0,0 +1,423 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "keystate.h"
+#include "shm.h"
+
+/* the client side of a device shared by a broker (see ../shm.c), opened as
+   shm:<path of the broker's socket>. leds are drawn into a local image which
+   is committed to our slot in the shared segment after every call; the
+   broker composites it with everyone else's. the grid is the broker's and
+   already rotated, so ours stays fixed. */
+
+#define SHM_T(x) ((monome_shm_client_t *) x)
+
+typedef struct {
+	monome_t monome;
+
+	int sock;
+	int flush_fd;
+
+	monome_shm_t *shm;
+	monome_shm_slot_t *slot;
+	size_t size;
+
+	uint8_t image[MONOME_SHM_MAX_LEDS];
+} monome_shm_client_t;
+
+/**
+ * private
+ */
+
+/* the new frame goes into the buffer the broker isn't reading, then we
+   flip. nothing here ever waits on the broker. */
+static int shm_commit(monome_t *monome) {
+	monome_shm_client_t *self = SHM_T(monome);
+	monome_shm_slot_t *s = self->slot;
+	uint32_t seq, back;
+	uint64_t one = 1;
+
+	seq = s->seq;
+	back = !s->front;
+
+	m_atomic_store_32(&s->seq, seq + 1);
+	m_atomic_fence();
+
+	memcpy(s->levels[back], self->image, monome->rows * monome->cols);
+	m_atomic_store_32(&s->front, back);
+
+	m_atomic_store_32(&s->seq, seq + 2);
+
+	return (write(self->flush_fd, &one, sizeof(one)) == sizeof(one)) ? 0 : -1;
+}
+
+static int image_fill(monome_t *monome, uint_t x, uint_t y, uint_t w,
+                      uint_t h, const uint8_t *levels, uint_t stride) {
+	monome_shm_client_t *self = SHM_T(monome);
+	uint_t i;
+
+	if( x >= monome->cols || y >= monome->rows )
+		return -1;
+
+	if( w > monome->cols - x )
+		w = monome->cols - x;
+
+	if( h > monome->rows - y )
+		h = monome->rows - y;
+
+	for( i = 0; i < h; i++ )
+		memcpy(&self->image[((y + i) * monome->cols) + x],
+		       &levels[i * stride], w);
+
+	return shm_commit(monome);
+}
+
+static void unpack_bits(uint8_t *levels, const uint8_t *data, size_t count) {
+	size_t i;
+
+	for( i = 0; i < count * 8; i++ )
+		levels[i] = (data[i >> 3] & (1 << (i & 7))) ? 15 : 0;
+}
+
+/**
+ * led level functions
+ */
+
+static int shm_led_level_set(monome_t *monome, uint_t x, uint_t y,
+                             uint_t level) {
+	uint8_t l = level & 0xF;
+	return image_fill(monome, x, y, 1, 1, &l, 1);
+}
+
+static int shm_led_level_all(monome_t *monome, uint_t level) {
+	memset(SHM_T(monome)->image, level & 0xF, monome->rows * monome->cols);
+	return shm_commit(monome);
+}
+
+static int shm_led_level_map(monome_t *monome, uint_t x_off, uint_t y_off,
+                             const uint8_t *data) {
+	return image_fill(monome, x_off, y_off, 8, 8, data, 8);
+}
+
+static int shm_led_level_row(monome_t *monome, uint_t x_off, uint_t y,
+                             size_t count, const uint8_t *data) {
+	return image_fill(monome, x_off, y, count, 1, data, count);
+}
+
+static int shm_led_level_col(monome_t *monome, uint_t x, uint_t y_off,
+                             size_t count, const uint8_t *data) {
+	return image_fill(monome, x, y_off, 1, count, data, 1);
+}
+
+/* the framebuffer has already worked out what changed, but the broker
+   diffs against what it has anyway, so the whole image goes across */
+static int shm_led_level_frame(monome_t *monome, const uint8_t *levels,
+                               uint64_t dirty) {
+	memcpy(SHM_T(monome)->image, levels, monome->rows * monome->cols);
+	return shm_commit(monome);
+}
+
+static monome_led_level_functions_t shm_led_level_functions = {
+	.set = shm_led_level_set,
+	.all = shm_led_level_all,
+	.map = shm_led_level_map,
+	.row = shm_led_level_row,
+	.col = shm_led_level_col,
+	.frame = shm_led_level_frame
+};
+
+/**
+ * led functions
+ */
+
+static int shm_led_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
+	return shm_led_level_set(monome, x, y, (on) ? 15 : 0);
+}
+
+static int shm_led_all(monome_t *monome, uint_t status) {
+	return shm_led_level_all(monome, (status) ? 15 : 0);
+}
+
+static int shm_led_map(monome_t *monome, uint_t x_off, uint_t y_off,
+                       const uint8_t *data) {
+	uint8_t levels[64];
+
+	unpack_bits(levels, data, 8);
+	return shm_led_level_map(monome, x_off, y_off, levels);
+}
+
+static int shm_led_row(monome_t *monome, uint_t x_off, uint_t y,
+                       size_t count, const uint8_t *data) {
+	uint8_t levels[MONOME_SHM_MAX_LEDS];
+
+	if( count > 8 )
+		return -1;
+
+	unpack_bits(levels, data, count);
+	return shm_led_level_row(monome, x_off, y, count * 8, levels);
+}
+
+static int shm_led_col(monome_t *monome, uint_t x, uint_t y_off,
+                       size_t count, const uint8_t *data) {
+	uint8_t levels[MONOME_SHM_MAX_LEDS];
+
+	if( count > 8 )
+		return -1;
+
+	unpack_bits(levels, data, count);
+	return shm_led_level_col(monome, x, y_off, count * 8, levels);
+}
+
+static int shm_led_intensity(monome_t *monome, uint_t brightness) {
+	/* the broker's to decide */
+	return 0;
+}
+
+static monome_led_functions_t shm_led_functions = {
+	.set = shm_led_set,
+	.all = shm_led_all,
+	.map = shm_led_map,
+	.row = shm_led_row,
+	.col = shm_led_col,
+	.intensity = shm_led_intensity
+};
+
+/* only there so the framebuffer is available, it's flushed through the
+   level frame hook rather than planned against these. */
+static monome_led_costs_t shm_led_costs = {
+	.set = 1, .all = 1, .map = 1, .row = 1, .col = 1,
+	.level_set = 1, .level_all = 1, .level_map = 1,
+	.level_row = 1, .level_col = 1
+};
+
+/**
+ * module interface
+ */
+
+static int shm_next_event(monome_t *monome, monome_event_t *e) {
+	monome_shm_client_t *self = SHM_T(monome);
+	monome_shm_slot_t *s = self->slot;
+	struct monome_shm_event se;
+	uint64_t count;
+	uint32_t tail;
+
+	tail = s->tail;
+
+	if( tail == m_atomic_load_32(&s->head) ) {
+		/* drain the eventfd before looking again, so an event published
+		   in between still leaves it readable */
+		if( read(monome->fd, &count, sizeof(count)) < 0 )
+			return 0;
+
+		if( tail == m_atomic_load_32(&s->head) )
+			return 0;
+	}
+
+	se = s->events[tail & (MONOME_SHM_EVENTS - 1)];
+	m_atomic_store_32(&s->tail, tail + 1);
+
+	e->event_type = se.type;
+
+	switch( se.type ) {
+	case MONOME_BUTTON_UP:
+	case MONOME_BUTTON_DOWN:
+		e->grid.x = se.v[0];
+		e->grid.y = se.v[1];
+
+		monome_keystate_update(monome, e->grid.x, e->grid.y,
+		                       se.type == MONOME_BUTTON_DOWN);
+		break;
+
+	case MONOME_ENCODER_DELTA:
+	case MONOME_ENCODER_KEY_UP:
+	case MONOME_ENCODER_KEY_DOWN:
+		e->encoder.number = se.v[0];
+		e->encoder.delta = se.v[1];
+		break;
+
+	case MONOME_TILT:
+		e->tilt.sensor = se.v[0];
+		e->tilt.x = se.v[1];
+		e->tilt.y = se.v[2];
+		e->tilt.z = se.v[3];
+		break;
+	}
+
+	return 1;
+}
+
+static int shm_pending(monome_t *monome) {
+	monome_shm_slot_t *s = SHM_T(monome)->slot;
+	return s->tail != m_atomic_load_32(&s->head);
+}
+
+static int recv_hello(int sock, struct monome_shm_hello *hello, int *fds) {
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	struct iovec iov = {hello, sizeof(*hello)};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof(u.buf)
+	};
+	struct cmsghdr *cmsg;
+
+	if( recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(*hello) )
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+
+	if( !cmsg || cmsg->cmsg_level != SOL_SOCKET
+	    || cmsg->cmsg_type != SCM_RIGHTS
+	    || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)) )
+		return -1;
+
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+	return 0;
+}
+
+static int shm_open_client(monome_t *monome, const char *dev,
+                           const char *serial, const monome_devmap_t *m,
+                           va_list args) {
+	monome_shm_client_t *self = SHM_T(monome);
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct monome_shm_hello hello;
+	uint16_t keys;
+	int fds[3] = {-1, -1, -1};
+	uint_t x, y;
+
+	if( strncmp(dev, "shm:", 4) || strlen(dev + 4) >= sizeof(addr.sun_path) )
+		return 1;
+
+	strcpy(addr.sun_path, dev + 4);
+
+	if( (self->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 )
+		return 1;
+
+	if( connect(self->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	    || recv_hello(self->sock, &hello, fds)
+	    || hello.slot >= MONOME_SHM_CLIENTS
+	    || hello.size != sizeof(monome_shm_t) )
+		goto err;
+
+	self->size = hello.size;
+	self->shm = mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                 fds[0], 0);
+
+	if( self->shm == MAP_FAILED ) {
+		self->shm = NULL;
+		goto err;
+	}
+
+	close(fds[0]);
+	fds[0] = -1;
+
+	if( self->shm->magic != MONOME_SHM_MAGIC
+	    || self->shm->version != MONOME_SHM_VERSION )
+		goto err;
+
+	self->slot = &self->shm->slots[hello.slot];
+	self->flush_fd = fds[1];
+	monome->fd = fds[2];
+
+	monome->rows = self->shm->rows;
+	monome->cols = self->shm->cols;
+	monome->serial = m_strdup(self->shm->serial);
+	monome->friendly = "shared grid";
+
+	/* start out knowing which keys are already held. this reads the rows
+	   directly rather than through the seqlock, since a broker that died
+	   mid-update would leave us waiting forever; a key changing under us
+	   will be along as an event anyway. */
+	for( y = 0; y < MONOME_KEYSTATE_ROWS; y++ ) {
+		keys = m_atomic_load_16(&self->shm->keys.rows[y]);
+
+		for( x = 0; x < 16; x++ )
+			if( keys & (1 << x) )
+				monome_keystate_update(monome, x, y, 1);
+	}
+
+	return 0;
+
+err:
+	for( x = 0; x < 3; x++ )
+		if( fds[x] >= 0 )
+			close(fds[x]);
+
+	if( self->shm )
+		munmap(self->shm, self->size);
+
+	close(self->sock);
+	return 1;
+}
+
+static int shm_close(monome_t *monome) {
+	monome_shm_client_t *self = SHM_T(monome);
+
+	munmap(self->shm, self->size);
+	close(self->flush_fd);
+	close(monome->fd);
+
+	/* which is how the broker finds out we've gone */
+	close(self->sock);
+	return 0;
+}
+
+static void shm_free(monome_t *monome) {
+	m_free(monome);
+}
+
+#if defined(EMBED_PROTOS)
+monome_t *monome_protocol_shm_new(void) {
+#else
+monome_t *monome_protocol_new(void) {
+#endif
+	monome_shm_client_t *self = m_calloc(1, sizeof(monome_shm_client_t));
+	monome_t *monome = (monome_t *) self;
+
+	if( !monome )
+		return NULL;
+
+	monome->open = shm_open_client;
+	monome->close = shm_close;
+	monome->free = shm_free;
+	monome->next_event = shm_next_event;
+	monome->fixed_rotation = 1;
+	monome->pending = shm_pending;
+
+	monome->led = &shm_led_functions;
+	monome->led_level = &shm_led_level_functions;
+	monome->led_costs = &shm_led_costs;
+	monome->led_ring = NULL;
+	monome->tilt = NULL;
+
+	return monome;
+}
@@ -0,0 +1,474 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "keystate.h"
+
+#include "tile.h"
+
+/* a virtual grid made of several real ones, opened as
+
+     tile:<device>@<x>,<y>[,<rotation>];<device>@<x>,<y>[,<rotation>];...
+
+   every member is placed with its top left corner at (x, y), which have to
+   be multiples of 8, after being rotated by 0, 90, 180 or 270 degrees. the
+   virtual grid covers all of them, and itself always stays unrotated:
+   monome_set_rotation() is ignored. */
+
+/**
+ * private
+ */
+
+static struct tile_member *member_at(monome_t *monome, uint_t x, uint_t y) {
+	monome_tile_t *tile = TILE_T(monome);
+	struct tile_member *mb;
+	uint_t i;
+
+	for( i = 0; i < tile->count; i++ ) {
+		mb = &tile->members[i];
+
+		if( x >= mb->x && x < mb->x + mb->cols
+		    && y >= mb->y && y < mb->y + mb->rows )
+			return mb;
+	}
+
+	return NULL;
+}
+
+static int members_overlap(const struct tile_member *a,
+                           const struct tile_member *b) {
+	return a->x < b->x + b->cols && b->x < a->x + a->cols
+		&& a->y < b->y + b->rows && b->y < a->y + a->rows;
+}
+
+static int member_open(monome_t *monome, char *spec) {
+	monome_tile_t *tile = TILE_T(monome);
+	struct tile_member *mb;
+	char *at, *end;
+	long rotation;
+	uint_t i;
+
+	if( tile->count >= TILE_MAX_MEMBERS || !(at = strrchr(spec, '@')) )
+		return -1;
+
+	*at++ = '\0';
+	mb = &tile->members[tile->count];
+
+	mb->x = strtoul(at, &end, 10);
+	if( *end++ != ',' )
+		return -1;
+
+	mb->y = strtoul(end, &end, 10);
+	rotation = 0;
+
+	if( *end == ',' )
+		rotation = strtol(end + 1, &end, 10);
+
+	if( *end || (mb->x | mb->y) & 7 || rotation % 90 || rotation < 0 )
+		return -1;
+
+	if( !(mb->dev = monome_open(spec)) )
+		return -1;
+
+	monome_set_rotation(mb->dev, (rotation / 90) & 3);
+	mb->rows = monome_get_rows(mb->dev);
+	mb->cols = monome_get_cols(mb->dev);
+
+	if( !mb->rows || !mb->cols || ((mb->rows | mb->cols) & 7)
+	    || mb->x + mb->cols > TILE_MAX_SIDE
+	    || mb->y + mb->rows > TILE_MAX_SIDE )
+		goto err;
+
+	for( i = 0; i < tile->count; i++ )
+		if( members_overlap(mb, &tile->members[i]) )
+			goto err;
+
+	tile->count++;
+	return 0;
+
+err:
+	monome_close(mb->dev);
+	return -1;
+}
+
+static void members_close(monome_t *monome) {
+	monome_tile_t *tile = TILE_T(monome);
+
+	while( tile->count )
+		monome_close(tile->members[--tile->count].dev);
+}
+
+/* pieces of a row or column, handed to whichever members they fall on.
+   offsets are in leds, and `unit` is how many leds one element of data
+   covers (8 for bitmaps, 1 for levels). */
+static int line_split(monome_t *monome, uint_t vertical, uint_t offset,
+                      uint_t line, size_t count, const uint8_t *data,
+                      uint_t unit, uint_t level) {
+	struct tile_member *mb;
+	uint_t i, n, pos;
+	int ret = 0;
+
+	for( i = 0; i < count; i += n ) {
+		pos = offset + (i * unit);
+		mb = (vertical) ? member_at(monome, line, pos)
+			: member_at(monome, pos, line);
+
+		/* count how much of the run lands on the same member */
+		for( n = 1; i + n < count; n++ )
+			if( ((vertical) ? member_at(monome, line, pos + (n * unit))
+			     : member_at(monome, pos + (n * unit), line)) != mb )
+				break;
+
+		if( !mb )
+			continue;
+
+		if( vertical ) {
+			ret |= (level)
+				? monome_led_level_col(mb->dev, line - mb->x, pos - mb->y,
+				                       n, &data[i])
+				: monome_led_col(mb->dev, line - mb->x, pos - mb->y,
+				                 n, &data[i]);
+		} else {
+			ret |= (level)
+				? monome_led_level_row(mb->dev, pos - mb->x, line - mb->y,
+				                       n, &data[i])
+				: monome_led_row(mb->dev, pos - mb->x, line - mb->y,
+				                 n, &data[i]);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * led functions
+ */
+
+static int tile_led_set(monome_t *monome, uint_t x, uint_t y, uint_t on) {
+	struct tile_member *mb;
+
+	if( !(mb = member_at(monome, x, y)) )
+		return -1;
+
+	return monome_led_set(mb->dev, x - mb->x, y - mb->y, on);
+}
+
+static int tile_led_all(monome_t *monome, uint_t status) {
+	monome_tile_t *tile = TILE_T(monome);
+	uint_t i;
+	int ret = 0;
+
+	for( i = 0; i < tile->count; i++ )
+		ret |= monome_led_all(tile->members[i].dev, status);
+
+	return ret;
+}
+
+static int tile_led_map(monome_t *monome, uint_t x_off, uint_t y_off,
+                        const uint8_t *data) {
+	struct tile_member *mb;
+
+	if( !(mb = member_at(monome, x_off, y_off)) )
+		return -1;
+
+	return monome_led_map(mb->dev, x_off - mb->x, y_off - mb->y, data);
+}
+
+static int tile_led_row(monome_t *monome, uint_t x_off, uint_t y,
+                        size_t count, const uint8_t *data) {
+	return line_split(monome, 0, x_off, y, count, data, 8, 0);
+}
+
+static int tile_led_col(monome_t *monome, uint_t x, uint_t y_off,
+                        size_t count, const uint8_t *data) {
+	return line_split(monome, 1, y_off, x, count, data, 8, 0);
+}
+
+static int tile_led_intensity(monome_t *monome, uint_t brightness) {
+	monome_tile_t *tile = TILE_T(monome);
+	uint_t i;
+	int ret = 0;
+
+	for( i = 0; i < tile->count; i++ )
+		ret |= monome_led_intensity(tile->members[i].dev, brightness);
+
+	return ret;
+}
+
+static monome_led_functions_t tile_led_functions = {
+	.set = tile_led_set,
+	.all = tile_led_all,
+	.map = tile_led_map,
+	.row = tile_led_row,
+	.col = tile_led_col,
+	.intensity = tile_led_intensity
+};
+
+/**
+ * led level functions
+ */
+
+static int tile_led_level_set(monome_t *monome, uint_t x, uint_t y,
+                              uint_t level) {
+	struct tile_member *mb;
+
+	if( !(mb = member_at(monome, x, y)) )
+		return -1;
+
+	return monome_led_level_set(mb->dev, x - mb->x, y - mb->y, level);
+}
+
+static int tile_led_level_all(monome_t *monome, uint_t level) {
+	monome_tile_t *tile = TILE_T(monome);
+	uint_t i;
+	int ret = 0;
+
+	for( i = 0; i < tile->count; i++ )
+		ret |= monome_led_level_all(tile->members[i].dev, level);
+
+	return ret;
+}
+
+static int tile_led_level_map(monome_t *monome, uint_t x_off, uint_t y_off,
+                              const uint8_t *data) {
+	struct tile_member *mb;
+
+	if( !(mb = member_at(monome, x_off, y_off)) )
+		return -1;
+
+	return monome_led_level_map(mb->dev, x_off - mb->x, y_off - mb->y, data);
+}
+
+static int tile_led_level_row(monome_t *monome, uint_t x_off, uint_t y,
+                              size_t count, const uint8_t *data) {
+	return line_split(monome, 0, x_off, y, count, data, 1, 1);
+}
+
+static int tile_led_level_col(monome_t *monome, uint_t x, uint_t y_off,
+                              size_t count, const uint8_t *data) {
+	return line_split(monome, 1, y_off, x, count, data, 1, 1);
+}
+
+/* hand each member the dirty quadrants that land on it, and let its own
+   framebuffer work out what actually changed. every member gets its share
+   before any of them is flushed, and each flush is a non-blocking write to
+   its own port, so they all go out together. */
+static int tile_led_level_frame(monome_t *monome, const uint8_t *levels,
+                                uint64_t dirty) {
+	monome_tile_t *tile = TILE_T(monome);
+	uint_t cols = monome->cols, qcols = monome->cols / 8;
+	struct tile_member *mb;
+	uint_t i, q, qx, qy, y;
+	uint8_t *dst;
+	int ret = 0;
+
+	for( q = 0; dirty >> q; q++ ) {
+		if( !((dirty >> q) & 1) )
+			continue;
+
+		qx = (q % qcols) * 8;
+		qy = (q / qcols) * 8;
+
+		if( !(mb = member_at(monome, qx, qy))
+		    || !(dst = monome_led_frame_get(mb->dev)) )
+			continue;
+
+		for( y = 0; y < 8; y++ )
+			memcpy(&dst[((qy - mb->y + y) * mb->cols) + (qx - mb->x)],
+			       &levels[((qy + y) * cols) + qx], 8);
+
+		monome_led_frame_dirty(mb->dev, qx - mb->x, qy - mb->y, 8, 8);
+	}
+
+	for( i = 0; i < tile->count; i++ )
+		ret |= monome_led_frame_flush(tile->members[i].dev);
+
+	return ret;
+}
+
+static monome_led_level_functions_t tile_led_level_functions = {
+	.set = tile_led_level_set,
+	.all = tile_led_level_all,
+	.map = tile_led_level_map,
+	.row = tile_led_level_row,
+	.col = tile_led_level_col,
+	.frame = tile_led_level_frame
+};
+
+/**
+ * module interface
+ */
+
+static int tile_next_event(monome_t *monome, monome_event_t *e) {
+	monome_tile_t *tile = TILE_T(monome);
+	struct tile_member *mb;
+	uint_t i, n;
+
+	for( i = 0; i < tile->count; i++ ) {
+		n = (tile->next + i) % tile->count;
+		mb = &tile->members[n];
+
+		if( monome_event_next(mb->dev, e) <= 0 )
+			continue;
+
+		tile->next = (n + 1) % tile->count;
+		e->monome = monome;
+
+		switch( e->event_type ) {
+		case MONOME_BUTTON_UP:
+		case MONOME_BUTTON_DOWN:
+			e->grid.x += mb->x;
+			e->grid.y += mb->y;
+
+			monome_keystate_update(monome, e->grid.x, e->grid.y,
+			                       e->event_type == MONOME_BUTTON_DOWN);
+			break;
+
+		default:
+			break;
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int tile_pending(monome_t *monome) {
+	monome_tile_t *tile = TILE_T(monome);
+	uint_t i;
+
+	for( i = 0; i < tile->count; i++ )
+		if( monome_event_pending(tile->members[i].dev) )
+			return 1;
+
+	return 0;
+}
+
+static int tile_open(monome_t *monome, const char *dev, const char *serial,
+                     const monome_devmap_t *m, va_list args) {
+	monome_tile_t *tile = TILE_T(monome);
+	char *specs, *spec, *next;
+	uint_t i;
+
+	if( strncmp(dev, "tile:", 5) || !(specs = m_strdup(dev + 5)) )
+		return 1;
+
+	for( spec = specs; spec; spec = next ) {
+		if( (next = strchr(spec, ';')) )
+			*next++ = '\0';
+
+		if( member_open(monome, spec) )
+			goto err;
+	}
+
+	if( !tile->count )
+		goto err;
+
+	m_free(specs);
+
+	for( i = 0; i < tile->count; i++ ) {
+		if( tile->members[i].x + tile->members[i].cols > monome->cols )
+			monome->cols = tile->members[i].x + tile->members[i].cols;
+
+		if( tile->members[i].y + tile->members[i].rows > monome->rows )
+			monome->rows = tile->members[i].y + tile->members[i].rows;
+	}
+
+	monome->serial = m_strdup("tile");
+	monome->friendly = "virtual grid";
+	monome->fd = -1;
+
+#if defined(__linux__)
+	/* an epoll instance is itself pollable, and becomes readable when any
+	   of the members are. elsewhere, callers poll the members. */
+	if( (monome->fd = epoll_create1(EPOLL_CLOEXEC)) >= 0 ) {
+		struct epoll_event ev = {.events = EPOLLIN};
+
+		for( i = 0; i < tile->count; i++ ) {
+			ev.data.u32 = i;
+
+			if( monome_get_fd(tile->members[i].dev) >= 0 )
+				epoll_ctl(monome->fd, EPOLL_CTL_ADD,
+				          monome_get_fd(tile->members[i].dev), &ev);
+		}
+	}
+#endif
+
+	/* only there so the framebuffer is available, it's flushed through
+	   the level frame hook rather than planned against these. */
+	tile->led_costs = (monome_led_costs_t) {
+		.set = 1, .all = 1, .map = 1, .row = 1, .col = 1,
+		.level_set = 1, .level_all = 1, .level_map = 1,
+		.level_row = 1, .level_col = 1
+	};
+
+	monome->led_costs = &tile->led_costs;
+	return 0;
+
+err:
+	m_free(specs);
+	members_close(monome);
+	return 1;
+}
+
+static int tile_close(monome_t *monome) {
+	if( monome->fd >= 0 )
+		close(monome->fd);
+
+	members_close(monome);
+	return 0;
+}
+
+static void tile_free(monome_t *monome) {
+	m_free(monome);
+}
+
+#if defined(EMBED_PROTOS)
+monome_t *monome_protocol_tile_new(void) {
+#else
+monome_t *monome_protocol_new(void) {
+#endif
+	monome_t *monome = m_calloc(1, sizeof(monome_tile_t));
+
+	if( !monome )
+		return NULL;
+
+	monome->open = tile_open;
+	monome->close = tile_close;
+	monome->free = tile_free;
+	monome->next_event = tile_next_event;
+	monome->fixed_rotation = 1;
+	monome->pending = tile_pending;
+
+	monome->led = &tile_led_functions;
+	monome->led_level = &tile_led_level_functions;
+	monome->led_ring = NULL;
+	monome->tilt = NULL;
+
+	return monome;
+}
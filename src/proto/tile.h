@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "monome.h"
+#include "internal.h"
+
+#define TILE_T(x) ((monome_tile_t *) x)
+typedef struct monome_tile monome_tile_t;
+
+/* the virtual grid is at most as big as key state is kept for. with the
+   smallest devices being 8x8, that's room for four. */
+#define TILE_MAX_SIDE    16
+#define TILE_MAX_MEMBERS 4
+
+struct tile_member {
+	monome_t *dev;
+
+	/* placement of its top left corner, and its size as rotated */
+	uint_t x, y;
+	uint_t rows, cols;
+};
+
+struct monome_tile {
+	monome_t monome;
+
+	struct tile_member members[TILE_MAX_MEMBERS];
+	uint_t count;
+
+	/* member to read from first next time round, so a busy one can't
+	   starve the others */
+	uint_t next;
+
+	monome_led_costs_t led_costs;
+};
@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2011 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "blend.h"
+#include "ringframe.h"
+
+/**
+ * private
+ */
+
+/* turns to a position in leds, in [0, MONOME_RING_LEDS) */
+static float ring_position(float turns) {
+	float p = turns - (float) (int) turns;
+
+	if( p < 0.f )
+		p += 1.f;
+
+	p *= MONOME_RING_LEDS;
+	return (p < MONOME_RING_LEDS) ? p : 0.f;
+}
+
+/* clockwise distance from `from` to `to`, in leds. a whole turn or more
+   covers the ring. */
+static float ring_length(float from, float to) {
+	float len = to - from;
+
+	if( len >= 1.f )
+		return MONOME_RING_LEDS;
+
+	len -= (float) (int) len;
+
+	if( len < 0.f )
+		len += 1.f;
+
+	return len * MONOME_RING_LEDS;
+}
+
+/* how much of each led, from 0 to 1, lies inside [start, start + len).
+   led i spans [i, i + 1). */
+static void ring_cover(float *cover, float start, float len) {
+	float end = start + len, lo, hi;
+	uint_t k;
+
+	memset(cover, 0, sizeof(float) * MONOME_RING_LEDS);
+
+	for( k = (uint_t) start; k < end; k++ ) {
+		lo = (k > start) ? k : start;
+		hi = (k + 1 < end) ? k + 1 : end;
+
+		cover[k & (MONOME_RING_LEDS - 1)] += hi - lo;
+	}
+}
+
+static uint8_t ring_level(float level) {
+	level += .5f;
+	return (level < 15.f) ? (uint8_t) level : 15;
+}
+
+/**
+ * public
+ */
+
+void monome_ring_draw_arc(uint8_t *levels, float from, float to,
+                          unsigned int level, monome_blend_t blend) {
+	uint8_t layer[MONOME_RING_LEDS];
+	float cover[MONOME_RING_LEDS];
+	uint_t i;
+
+	ring_cover(cover, ring_position(from), ring_length(from, to));
+
+	for( i = 0; i < MONOME_RING_LEDS; i++ )
+		layer[i] = ring_level((level & 0xF) * cover[i]);
+
+	blend_levels(levels, layer, MONOME_RING_LEDS, blend);
+}
+
+void monome_ring_draw_gradient(uint8_t *levels, float from, float to,
+                               unsigned int level_from, unsigned int level_to,
+                               monome_blend_t blend) {
+	uint8_t layer[MONOME_RING_LEDS];
+	float cover[MONOME_RING_LEDS];
+	float start, len, slope, t;
+	uint_t i;
+
+	start = ring_position(from);
+	len = ring_length(from, to);
+	ring_cover(cover, start, len);
+
+	level_from &= 0xF;
+	level_to &= 0xF;
+	slope = (len > 0.f) ? ((float) level_to - level_from) / len : 0.f;
+
+	/* each led takes the gradient's level at its centre, held at the ends.
+	   the first led's centre can be up to half an led short of start, which
+	   is still the start of the gradient and not the far end of the ring. */
+	for( i = 0; i < MONOME_RING_LEDS; i++ ) {
+		t = i + .5f - start;
+		t += (t < -.5f) ? MONOME_RING_LEDS : 0.f;
+		t = (t > 0.f) ? t : 0.f;
+		t = (t < len) ? t : len;
+
+		layer[i] = ring_level((level_from + (slope * t)) * cover[i]);
+	}
+
+	blend_levels(levels, layer, MONOME_RING_LEDS, blend);
+}
+
+void monome_ring_draw_pointer(uint8_t *levels, float position,
+                              unsigned int level, monome_blend_t blend) {
+	uint8_t layer[MONOME_RING_LEDS] = {0};
+	float p, frac;
+	uint_t i;
+
+	/* split between the two nearest leds by how close it is to each */
+	p = ring_position(position);
+	i = (uint_t) p;
+	frac = p - i;
+
+	layer[i] = ring_level((level & 0xF) * (1.f - frac));
+	layer[(i + 1) & (MONOME_RING_LEDS - 1)] = ring_level((level & 0xF) * frac);
+
+	blend_levels(levels, layer, MONOME_RING_LEDS, blend);
+}
+
+void monome_ring_blend(uint8_t *levels, const uint8_t *src,
+                       monome_blend_t blend) {
+	blend_levels(levels, src, MONOME_RING_LEDS, blend);
+}
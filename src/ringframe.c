@@ -0,0 +1,246 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "ringframe.h"
+
+#define COST_INFINITE ((uint_t) -1)
+#define RING_WRAP(i) ((i) & (MONOME_RING_LEDS - 1))
+
+/* a set when start == end, a range otherwise. ranges run clockwise from
+   start to end inclusive, wrapping past the last led. */
+typedef struct {
+	uint8_t start, end, level;
+} ring_op_t;
+
+typedef struct {
+	uint_t cost;
+	uint_t nops;
+	ring_op_t ops[MONOME_RING_LEDS];
+} ring_plan_t;
+
+/**
+ * planning
+ */
+
+static monome_ring_shadow_t *ring_shadow_get(monome_t *monome) {
+	if( !monome->rings )
+		monome->rings = m_calloc(1, sizeof(monome_ring_shadow_t));
+
+	return monome->rings;
+}
+
+static void ring_plan_add(ring_plan_t *plan, uint_t cost, uint_t start,
+                          uint_t end, uint_t level) {
+	plan->cost += cost;
+	plan->ops[plan->nops++] = (ring_op_t) {
+		.start = start,
+		.end   = end,
+		.level = level
+	};
+}
+
+/* plan the sets and ranges that turn base into want. want is split into
+   runs of leds sharing a level; each run containing a change is either
+   covered by one range or has its changed leds set one by one. */
+static void ring_plan_patch(const monome_led_ring_costs_t *c,
+                            ring_plan_t *plan, const uint8_t *base,
+                            const uint8_t *want) {
+	uint_t first, i, len, changed, n;
+
+	plan->cost = plan->nops = 0;
+
+	/* start at the beginning of a run so none straddles the wrap */
+	for( first = 0; first < MONOME_RING_LEDS; first++ )
+		if( want[first] != want[RING_WRAP(first + MONOME_RING_LEDS - 1)] )
+			break;
+
+	if( first == MONOME_RING_LEDS )
+		first = 0;
+
+	for( i = 0; i < MONOME_RING_LEDS; i += len ) {
+		for( len = changed = 0; i + len < MONOME_RING_LEDS; len++ ) {
+			n = RING_WRAP(first + i + len);
+
+			if( want[n] != want[RING_WRAP(first + i)] )
+				break;
+
+			changed += (base[n] != want[n]);
+		}
+
+		if( !changed )
+			continue;
+
+		if( c->range && c->range < changed * c->set ) {
+			ring_plan_add(plan, c->range, RING_WRAP(first + i),
+			              RING_WRAP(first + i + len - 1),
+			              want[RING_WRAP(first + i)]);
+			continue;
+		}
+
+		for( n = 0; n < len; n++ )
+			if( base[RING_WRAP(first + i + n)] != want[RING_WRAP(first + i + n)] )
+				ring_plan_add(plan, c->set, RING_WRAP(first + i + n),
+				              RING_WRAP(first + i + n),
+				              want[RING_WRAP(first + i + n)]);
+	}
+}
+
+/* the level most of the ring is at, the best thing to clear it to */
+static uint_t ring_common_level(const uint8_t *want) {
+	uint_t counts[16] = {0};
+	uint_t i, best;
+
+	for( i = 0; i < MONOME_RING_LEDS; i++ )
+		counts[want[i]]++;
+
+	for( best = 0, i = 1; i < 16; i++ )
+		if( counts[i] > counts[best] )
+			best = i;
+
+	return best;
+}
+
+static int ring_plan_emit(monome_t *monome, uint_t ring,
+                          const ring_plan_t *plan) {
+	const ring_op_t *op;
+	uint_t i;
+
+	for( i = 0; i < plan->nops; i++ ) {
+		op = &plan->ops[i];
+
+		if( op->start == op->end ) {
+			if( monome->led_ring->set(monome, ring, op->start, op->level) < 0 )
+				return -1;
+		} else if( monome->led_ring->range(
+				monome, ring, op->start, op->end, op->level) < 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * ring frames
+ */
+
+int monome_ring_frame(monome_t *monome, uint_t ring, const uint8_t *levels) {
+	const monome_led_ring_costs_t *c = monome->ring_costs;
+	monome_ring_shadow_t *rs;
+	uint8_t want[MONOME_RING_LEDS], base[MONOME_RING_LEDS];
+	ring_plan_t patch, cleared;
+	uint_t i, level, all_cost;
+
+	/* without a shadow there's nothing to diff against */
+	if( ring >= MONOME_RING_MAX || !(rs = ring_shadow_get(monome)) )
+		return (monome->led_ring->map(monome, ring, levels) < 0) ? -1 : 0;
+
+	for( i = 0; i < MONOME_RING_LEDS; i++ )
+		want[i] = levels[i] & 0xF;
+
+	patch.cost = COST_INFINITE;
+
+	if( rs->known & (1 << ring) ) {
+		if( !memcmp(rs->levels[ring], want, sizeof(want)) )
+			return 0;
+
+		ring_plan_patch(c, &patch, rs->levels[ring], want);
+	}
+
+	/* or start over from a clean slate */
+	cleared.cost = all_cost = COST_INFINITE;
+
+	level = ring_common_level(want);
+
+	if( c->all ) {
+		memset(base, level, sizeof(base));
+		ring_plan_patch(c, &cleared, base, want);
+		all_cost = c->all + cleared.cost;
+	}
+
+	if( patch.cost <= all_cost && patch.cost <= c->map ) {
+		if( ring_plan_emit(monome, ring, &patch) )
+			goto err;
+	} else if( all_cost <= c->map ) {
+		if( monome->led_ring->all(monome, ring, level) < 0
+		    || ring_plan_emit(monome, ring, &cleared) )
+			goto err;
+	} else if( monome->led_ring->map(monome, ring, want) < 0 )
+		goto err;
+
+	memcpy(rs->levels[ring], want, sizeof(want));
+	rs->known |= 1 << ring;
+	return 0;
+
+err:
+	rs->known &= ~(1 << ring);
+	return -1;
+}
+
+void monome_ring_shadow_set(monome_t *monome, uint_t ring, uint_t led,
+                            uint_t level) {
+	if( monome->rings && ring < MONOME_RING_MAX )
+		monome->rings->levels[ring][RING_WRAP(led)] = level & 0xF;
+}
+
+void monome_ring_shadow_all(monome_t *monome, uint_t ring, uint_t level) {
+	if( !monome->rings || ring >= MONOME_RING_MAX )
+		return;
+
+	memset(monome->rings->levels[ring], level & 0xF, MONOME_RING_LEDS);
+	monome->rings->known |= 1 << ring;
+}
+
+void monome_ring_shadow_map(monome_t *monome, uint_t ring,
+                            const uint8_t *levels) {
+	uint_t i;
+
+	if( !monome->rings || ring >= MONOME_RING_MAX )
+		return;
+
+	for( i = 0; i < MONOME_RING_LEDS; i++ )
+		monome->rings->levels[ring][i] = levels[i] & 0xF;
+
+	monome->rings->known |= 1 << ring;
+}
+
+void monome_ring_shadow_range(monome_t *monome, uint_t ring, uint_t start,
+                              uint_t end, uint_t level) {
+	uint_t i;
+
+	if( !monome->rings || ring >= MONOME_RING_MAX )
+		return;
+
+	for( i = RING_WRAP(start); i != RING_WRAP(end); i = RING_WRAP(i + 1) )
+		monome->rings->levels[ring][i] = level & 0xF;
+
+	monome->rings->levels[ring][i] = level & 0xF;
+}
+
+void monome_ring_shadow_forget(monome_t *monome, uint_t ring) {
+	if( monome->rings && ring < MONOME_RING_MAX )
+		monome->rings->known &= ~(1 << ring);
+}
+
+void monome_ring_shadow_free(monome_t *monome) {
+	m_free(monome->rings);
+	monome->rings = NULL;
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "schedule.h"
+
+#define TICK_USEC 1000
+#define SLOT_OF(tick) ((tick) & (SCHEDULE_WHEEL_SLOTS - 1))
+
+static monome_schedule_t *scheduler_get(monome_t *monome) {
+	monome_schedule_t *s;
+	uint_t i;
+
+	if( monome->sched )
+		return monome->sched;
+
+	if( !(s = m_calloc(1, sizeof(*s))) )
+		return NULL;
+
+	for( i = 0; i < SCHEDULE_WHEEL_SLOTS; i++ )
+		s->slots[i].tail = &s->slots[i].head;
+
+	s->tick = m_time_usec() / TICK_USEC;
+
+	monome->sched = s;
+	return s;
+}
+
+static void scheduler_insert(monome_schedule_t *s, monome_scheduled_t *u) {
+	uint64_t tick = u->when / TICK_USEC;
+
+	/* anything already overdue goes in the slot that's processed next */
+	if( tick < s->tick )
+		tick = s->tick;
+
+	u->next = NULL;
+
+	*s->slots[SLOT_OF(tick)].tail = u;
+	s->slots[SLOT_OF(tick)].tail = &u->next;
+
+	s->pending++;
+}
+
+int monome_scheduler_begin(monome_t *monome, uint64_t when) {
+	monome_schedule_t *s;
+
+	if( !(s = scheduler_get(monome)) || s->capturing )
+		return -1;
+
+	s->capturing = 1;
+	s->when = when;
+	s->len  = 0;
+
+	return 0;
+}
+
+int monome_scheduler_end(monome_t *monome) {
+	monome_schedule_t *s = monome->sched;
+	monome_scheduled_t *u;
+
+	if( !s || !s->capturing )
+		return -1;
+
+	s->capturing = 0;
+
+	if( !s->len )
+		return 0;
+
+	if( !(u = m_malloc(sizeof(*u) + s->len)) )
+		return -1;
+
+	u->when = s->when;
+	u->len  = s->len;
+	memcpy(u->data, s->buf, s->len);
+
+	scheduler_insert(s, u);
+	return 0;
+}
+
+int monome_scheduler_capturing(monome_t *monome) {
+	return monome->sched && monome->sched->capturing;
+}
+
+ssize_t monome_scheduler_capture(monome_t *monome, const uint8_t *buf,
+                                 size_t nbyte) {
+	monome_schedule_t *s = monome->sched;
+	uint8_t *grown;
+	size_t size;
+
+	if( s->len + nbyte > s->size ) {
+		for( size = (s->size) ? s->size : 64; size < s->len + nbyte; )
+			size *= 2;
+
+		if( !(grown = m_malloc(size)) )
+			return -1;
+
+		if( s->len )
+			memcpy(grown, s->buf, s->len);
+
+		m_free(s->buf);
+		s->buf  = grown;
+		s->size = size;
+	}
+
+	memcpy(s->buf + s->len, buf, nbyte);
+	s->len += nbyte;
+
+	return nbyte;
+}
+
+/* the earliest deadline on the wheel. checks one lap's worth of slots for
+   an update due in that lap before falling back to looking at everything. */
+static uint64_t scheduler_next(monome_schedule_t *s) {
+	monome_scheduled_t *u;
+	uint64_t tick, next;
+	uint_t i;
+
+	next = UINT64_MAX;
+
+	for( i = 0; i < SCHEDULE_WHEEL_SLOTS; i++ ) {
+		tick = s->tick + i;
+
+		for( u = s->slots[SLOT_OF(tick)].head; u; u = u->next )
+			if( u->when / TICK_USEC <= tick && u->when < next )
+				next = u->when;
+
+		if( next != UINT64_MAX )
+			return next;
+	}
+
+	for( i = 0; i < SCHEDULE_WHEEL_SLOTS; i++ )
+		for( u = s->slots[i].head; u; u = u->next )
+			if( u->when < next )
+				next = u->when;
+
+	return next;
+}
+
+int monome_scheduler_run(monome_t *monome) {
+	monome_schedule_t *s = monome->sched;
+	monome_scheduled_t *u, **link;
+	uint64_t now, now_tick, tick, next;
+
+	if( !s || s->capturing || !s->pending )
+		return -1;
+
+	now = m_time_usec();
+	now_tick = now / TICK_USEC;
+
+	/* no need to go round more than once */
+	tick = s->tick;
+	if( now_tick - tick >= SCHEDULE_WHEEL_SLOTS )
+		tick = now_tick - SCHEDULE_WHEEL_SLOTS + 1;
+
+	for( ; tick <= now_tick; tick++ ) {
+		link = &s->slots[SLOT_OF(tick)].head;
+
+		while( (u = *link) ) {
+			if( u->when > now ) {
+				link = &u->next;
+				continue;
+			}
+
+			if( !(*link = u->next) )
+				s->slots[SLOT_OF(tick)].tail = link;
+
+			monome_platform_write(monome, u->data, u->len);
+
+			m_free(u);
+			s->pending--;
+		}
+	}
+
+	/* the current tick may still have updates due later in it */
+	s->tick = now_tick;
+
+	if( !s->pending )
+		return -1;
+
+	next = scheduler_next(s);
+	return (next > now) ? ((next - now + TICK_USEC - 1) / TICK_USEC) : 0;
+}
+
+void monome_scheduler_free(monome_t *monome) {
+	monome_schedule_t *s = monome->sched;
+	monome_scheduled_t *u, *next;
+	uint_t i;
+
+	if( !s )
+		return;
+
+	for( i = 0; i < SCHEDULE_WHEEL_SLOTS; i++ )
+		for( u = s->slots[i].head; u; u = next ) {
+			next = u->next;
+			m_free(u);
+		}
+
+	m_free(s->buf);
+	m_free(s);
+
+	monome->sched = NULL;
+}
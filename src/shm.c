@@ -0,0 +1,471 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "shm.h"
+
+#if defined(__linux__)
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "keystate.h"
+
+/* a device shared with other processes on the same host. we own the
+   device; clients connect to a unix socket and are handed the segment and
+   a pair of eventfds over it. each client draws into its own slot, which
+   we composite in as a layer of the same number, and gets its own copy of
+   every event. */
+
+#define TAG_LISTEN 0
+#define TAG_DEVICE 1
+#define TAG_SOCK   2
+#define TAG_FLUSH  3
+
+#define TAG(tag, slot) (((slot) << 8) | (tag))
+
+struct monome_shm_broker {
+	char *path;
+
+	int listen_fd;
+	int epfd;
+
+	int memfd;
+	monome_shm_t *shm;
+
+	struct {
+		int sock;
+		int flush_fd;
+		int event_fd;
+	} clients[MONOME_SHM_CLIENTS];
+
+	uint8_t frame[MONOME_SHM_MAX_LEDS];
+};
+
+/**
+ * private
+ */
+
+static int epoll_add(monome_shm_broker_t *b, int fd, uint32_t tag) {
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u32 = tag
+	};
+
+	return epoll_ctl(b->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void client_drop(monome_t *monome, uint_t slot) {
+	monome_shm_broker_t *b = monome->shm;
+	uint8_t *layer;
+
+	/* the client holds the same flush eventfd, so closing our end alone
+	   wouldn't take it out of the epoll set */
+	epoll_ctl(b->epfd, EPOLL_CTL_DEL, b->clients[slot].sock, NULL);
+	epoll_ctl(b->epfd, EPOLL_CTL_DEL, b->clients[slot].flush_fd, NULL);
+
+	close(b->clients[slot].sock);
+	close(b->clients[slot].flush_fd);
+	close(b->clients[slot].event_fd);
+	b->clients[slot].sock = -1;
+
+	/* take whatever it left on the grid with it */
+	if( (layer = monome_led_layer_get(monome, slot)) ) {
+		memset(layer, 0, monome_get_rows(monome) * monome_get_cols(monome));
+		monome_led_layer_dirty(monome, 0, 0, monome_get_cols(monome),
+		                       monome_get_rows(monome));
+		monome_led_frame_flush(monome);
+	}
+}
+
+static int send_hello(int sock, uint_t slot, uint_t size, const int *fds) {
+	struct monome_shm_hello hello = {.slot = slot, .size = size};
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	struct iovec iov = {&hello, sizeof(hello)};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof(u.buf)
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+	return (sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(hello)) ? 0 : -1;
+}
+
+static void client_accept(monome_t *monome) {
+	monome_shm_broker_t *b = monome->shm;
+	monome_shm_slot_t *s;
+	uint_t slot;
+	int sock, fds[3];
+
+	if( (sock = accept4(b->listen_fd, NULL, NULL,
+	                    SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 )
+		return;
+
+	for( slot = 0; slot < MONOME_SHM_CLIENTS; slot++ )
+		if( b->clients[slot].sock < 0 )
+			break;
+
+	/* full up, hanging up on them is the only answer we have */
+	if( slot == MONOME_SHM_CLIENTS
+	    || !monome_led_layer_get(monome, slot) )
+		goto err_sock;
+
+	s = &b->shm->slots[slot];
+	memset(s, 0, sizeof(*s));
+
+	b->clients[slot].flush_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	b->clients[slot].event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if( b->clients[slot].flush_fd < 0 || b->clients[slot].event_fd < 0 )
+		goto err_fds;
+
+	fds[0] = b->memfd;
+	fds[1] = b->clients[slot].flush_fd;
+	fds[2] = b->clients[slot].event_fd;
+
+	if( send_hello(sock, slot, sizeof(monome_shm_t), fds)
+	    || epoll_add(b, sock, TAG(TAG_SOCK, slot))
+	    || epoll_add(b, fds[1], TAG(TAG_FLUSH, slot)) )
+		goto err_fds;
+
+	b->clients[slot].sock = sock;
+	monome_led_layer_blend(monome, slot, MONOME_BLEND_MAX);
+	return;
+
+err_fds:
+	if( b->clients[slot].flush_fd >= 0 )
+		close(b->clients[slot].flush_fd);
+	if( b->clients[slot].event_fd >= 0 )
+		close(b->clients[slot].event_fd);
+err_sock:
+	close(sock);
+}
+
+/* copy out the client's last committed frame, and pass on only the tiles
+   that changed since the one before. the client may be stopped or dead
+   halfway through a commit, so we never wait on it: if we catch it
+   mid-commit, that commit's own kick of the eventfd is still to come and
+   we'll pick its frame up then. */
+static void client_flush(monome_t *monome, uint_t slot) {
+	monome_shm_broker_t *b = monome->shm;
+	monome_shm_slot_t *s = &b->shm->slots[slot];
+	uint_t rows, cols, size, x, y, i;
+	uint32_t seq, front;
+	uint64_t count;
+	uint8_t *layer;
+
+	if( read(b->clients[slot].flush_fd, &count, sizeof(count)) < 0 )
+		return;
+
+	rows = monome_get_rows(monome);
+	cols = monome_get_cols(monome);
+	size = rows * cols;
+
+	if( !(layer = monome_led_layer_get(monome, slot)) )
+		return;
+
+	if( (seq = m_atomic_load_32(&s->seq)) & 1 )
+		return;
+
+	front = m_atomic_load_32(&s->front) & 1;
+	memcpy(b->frame, s->levels[front], size);
+
+	m_atomic_fence();
+	if( seq != m_atomic_load_32(&s->seq) )
+		return;
+
+	for( y = 0; y < rows; y += 8 ) {
+		for( x = 0; x < cols; x += 8 ) {
+			for( i = 0; i < 8; i++ )
+				if( memcmp(&layer[((y + i) * cols) + x],
+				           &b->frame[((y + i) * cols) + x], 8) )
+					break;
+
+			if( i == 8 )
+				continue;
+
+			for( i = 0; i < 8; i++ )
+				memcpy(&layer[((y + i) * cols) + x],
+				       &b->frame[((y + i) * cols) + x], 8);
+
+			monome_led_layer_dirty(monome, x, y, 8, 8);
+		}
+	}
+
+	monome_led_frame_flush(monome);
+}
+
+static void event_publish(monome_t *monome, const monome_event_t *e) {
+	monome_shm_broker_t *b = monome->shm;
+	struct monome_shm_event se = {.type = e->event_type};
+	monome_shm_slot_t *s;
+	uint64_t one = 1;
+	uint32_t head;
+	uint_t slot;
+
+	switch( e->event_type ) {
+	case MONOME_BUTTON_UP:
+	case MONOME_BUTTON_DOWN:
+		se.v[0] = e->grid.x;
+		se.v[1] = e->grid.y;
+
+		keystate_set(&b->shm->keys, e->grid.x, e->grid.y,
+		             e->event_type == MONOME_BUTTON_DOWN);
+		break;
+
+	case MONOME_ENCODER_DELTA:
+	case MONOME_ENCODER_KEY_UP:
+	case MONOME_ENCODER_KEY_DOWN:
+		se.v[0] = e->encoder.number;
+		se.v[1] = e->encoder.delta;
+		break;
+
+	case MONOME_TILT:
+		se.v[0] = e->tilt.sensor;
+		se.v[1] = e->tilt.x;
+		se.v[2] = e->tilt.y;
+		se.v[3] = e->tilt.z;
+		break;
+
+	default:
+		return;
+	}
+
+	for( slot = 0; slot < MONOME_SHM_CLIENTS; slot++ ) {
+		if( b->clients[slot].sock < 0 )
+			continue;
+
+		s = &b->shm->slots[slot];
+		head = s->head;
+
+		/* a client that isn't keeping up loses events, the rest don't */
+		if( head - m_atomic_load_32(&s->tail) >= MONOME_SHM_EVENTS )
+			continue;
+
+		s->events[head & (MONOME_SHM_EVENTS - 1)] = se;
+		m_atomic_store_32(&s->head, head + 1);
+
+		if( write(b->clients[slot].event_fd, &one, sizeof(one)) < 0 )
+			continue;
+	}
+}
+
+static void device_read(monome_t *monome) {
+	monome_callback_t *handler;
+	monome_event_t e;
+
+	while( monome_event_next(monome, &e) > 0 ) {
+		event_publish(monome, &e);
+
+		handler = &monome->handlers[e.event_type];
+		if( handler->cb )
+			handler->cb(&e, handler->data);
+	}
+}
+
+/**
+ * public
+ */
+
+int monome_shm_publish(monome_t *monome, const char *path) {
+	monome_shm_broker_t *b;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	uint_t slot;
+
+	if( monome->shm || !path || strlen(path) >= sizeof(addr.sun_path)
+	    || !monome_led_layer_get(monome, 0)
+	    || monome_get_rows(monome) * monome_get_cols(monome)
+	       > MONOME_SHM_MAX_LEDS )
+		return -1;
+
+	if( !(b = m_calloc(1, sizeof(*b))) )
+		return -1;
+
+	b->listen_fd = b->epfd = b->memfd = -1;
+
+	for( slot = 0; slot < MONOME_SHM_CLIENTS; slot++ )
+		b->clients[slot].sock = -1;
+
+	if( !(b->path = m_strdup(path)) )
+		goto err;
+
+	if( (b->memfd = memfd_create("monome", MFD_CLOEXEC)) < 0
+	    || ftruncate(b->memfd, sizeof(monome_shm_t)) < 0 )
+		goto err;
+
+	b->shm = mmap(NULL, sizeof(monome_shm_t), PROT_READ | PROT_WRITE,
+	              MAP_SHARED, b->memfd, 0);
+
+	if( b->shm == MAP_FAILED ) {
+		b->shm = NULL;
+		goto err;
+	}
+
+	b->shm->rows = monome_get_rows(monome);
+	b->shm->cols = monome_get_cols(monome);
+	if( monome_get_serial(monome) )
+		strncpy(b->shm->serial, monome_get_serial(monome),
+		        sizeof(b->shm->serial) - 1);
+
+	b->shm->magic = MONOME_SHM_MAGIC;
+	b->shm->version = MONOME_SHM_VERSION;
+
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if( (b->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK
+	                           | SOCK_CLOEXEC, 0)) < 0
+	    || bind(b->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	    || listen(b->listen_fd, MONOME_SHM_CLIENTS) < 0 )
+		goto err;
+
+	if( (b->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0
+	    || epoll_add(b, b->listen_fd, TAG(TAG_LISTEN, 0))
+	    || (monome_get_fd(monome) >= 0
+	        && epoll_add(b, monome_get_fd(monome), TAG(TAG_DEVICE, 0))) )
+		goto err;
+
+	monome->shm = b;
+	return 0;
+
+err:
+	monome->shm = b;
+	monome_shm_free(monome);
+	return -1;
+}
+
+int monome_shm_get_fd(monome_t *monome) {
+	return (monome->shm) ? monome->shm->epfd : -1;
+}
+
+int monome_shm_service(monome_t *monome) {
+	monome_shm_broker_t *b = monome->shm;
+	struct epoll_event evs[2 + (2 * MONOME_SHM_CLIENTS)];
+	uint_t slot;
+	int i, n;
+
+	if( !b )
+		return -1;
+
+	if( (n = epoll_wait(b->epfd, evs, sizeof(evs) / sizeof(*evs), 0)) < 0 )
+		return -1;
+
+	for( i = 0; i < n; i++ ) {
+		slot = evs[i].data.u32 >> 8;
+
+		switch( evs[i].data.u32 & 0xFF ) {
+		case TAG_LISTEN:
+			client_accept(monome);
+			break;
+
+		case TAG_DEVICE:
+			device_read(monome);
+			break;
+
+		case TAG_SOCK:
+			/* clients never say anything, so this is them going away */
+			if( b->clients[slot].sock >= 0 )
+				client_drop(monome, slot);
+			break;
+
+		case TAG_FLUSH:
+			if( b->clients[slot].sock >= 0 )
+				client_flush(monome, slot);
+			break;
+		}
+	}
+
+	return n;
+}
+
+void monome_shm_free(monome_t *monome) {
+	monome_shm_broker_t *b = monome->shm;
+	uint_t slot;
+
+	if( !b )
+		return;
+
+	for( slot = 0; slot < MONOME_SHM_CLIENTS; slot++ ) {
+		if( b->clients[slot].sock < 0 )
+			continue;
+
+		close(b->clients[slot].sock);
+		close(b->clients[slot].flush_fd);
+		close(b->clients[slot].event_fd);
+	}
+
+	if( b->listen_fd >= 0 ) {
+		close(b->listen_fd);
+		unlink(b->path);
+	}
+
+	if( b->epfd >= 0 )
+		close(b->epfd);
+
+	if( b->shm )
+		munmap(b->shm, sizeof(monome_shm_t));
+
+	if( b->memfd >= 0 )
+		close(b->memfd);
+
+	m_free(b->path);
+	m_free(b);
+
+	monome->shm = NULL;
+}
+
+#else /* !defined(__linux__) */
+
+int monome_shm_publish(monome_t *monome, const char *path) {
+	return -1;
+}
+
+int monome_shm_get_fd(monome_t *monome) {
+	return -1;
+}
+
+int monome_shm_service(monome_t *monome) {
+	return -1;
+}
+
+void monome_shm_free(monome_t *monome) {
+	return;
+}
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2010 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "platform.h"
+#include "tilt.h"
+
+void monome_tilt_filter_set(monome_t *monome, uint_t sensor, uint_t max_rate,
+                            uint_t threshold) {
+	monome_tilt_filter_t *f;
+
+	if( sensor >= MONOME_TILT_SENSORS )
+		return;
+
+	f = &monome->tilt_filters[sensor];
+
+	f->interval  = (max_rate) ? 1000000 / max_rate : 0;
+	f->threshold = threshold;
+	f->have_last = 0;
+	f->have_held = 0;
+}
+
+static int tilt_moved(monome_tilt_filter_t *f, int x, int y, int z) {
+	/* every axis has to have moved less than the threshold for the event
+	   to be dropped */
+	return abs(x - f->x) >= f->threshold
+		|| abs(y - f->y) >= f->threshold
+		|| abs(z - f->z) >= f->threshold;
+}
+
+static void tilt_delivered(monome_tilt_filter_t *f, uint64_t now,
+                           int x, int y, int z) {
+	f->have_last = 1;
+	f->have_held = 0;
+	f->last_time = now;
+	f->x = x;
+	f->y = y;
+	f->z = z;
+}
+
+int monome_tilt_filter(monome_t *monome, const monome_event_t *e) {
+	monome_tilt_filter_t *f;
+	uint64_t now;
+
+	if( e->tilt.sensor >= MONOME_TILT_SENSORS )
+		return 1;
+
+	f = &monome->tilt_filters[e->tilt.sensor];
+
+	if( !f->interval && !f->threshold )
+		return 1;
+
+	now = (f->interval) ? m_time_usec() : 0;
+
+	if( f->have_last ) {
+		if( f->interval && now - f->last_time < f->interval ) {
+			f->have_held = 1;
+			f->held_x = e->tilt.x;
+			f->held_y = e->tilt.y;
+			f->held_z = e->tilt.z;
+			return 0;
+		}
+
+		if( !tilt_moved(f, e->tilt.x, e->tilt.y, e->tilt.z) ) {
+			f->have_held = 0;
+			return 0;
+		}
+	}
+
+	tilt_delivered(f, now, e->tilt.x, e->tilt.y, e->tilt.z);
+	return 1;
+}
+
+int monome_tilt_filter_next(monome_t *monome, monome_event_t *e) {
+	monome_tilt_filter_t *f;
+	uint64_t now;
+	uint_t i;
+
+	now = m_time_usec();
+
+	for( i = 0; i < MONOME_TILT_SENSORS; i++ ) {
+		f = &monome->tilt_filters[i];
+
+		if( !f->have_held || now - f->last_time < f->interval )
+			continue;
+
+		f->have_held = 0;
+
+		if( !tilt_moved(f, f->held_x, f->held_y, f->held_z) )
+			continue;
+
+		e->event_type  = MONOME_TILT;
+		e->tilt.sensor = i;
+		e->tilt.x      = f->held_x;
+		e->tilt.y      = f->held_y;
+		e->tilt.z      = f->held_z;
+
+		tilt_delivered(f, now, f->held_x, f->held_y, f->held_z);
+		return 1;
+	}
+
+	return 0;
+}
+
+int monome_tilt_filter_timeout(monome_t *monome) {
+	monome_tilt_filter_t *f;
+	uint64_t now, left;
+	int timeout = -1;
+	uint_t i;
+
+	now = m_time_usec();
+
+	for( i = 0; i < MONOME_TILT_SENSORS; i++ ) {
+		f = &monome->tilt_filters[i];
+
+		if( !f->have_held )
+			continue;
+
+		left = f->last_time + f->interval;
+		left = (left > now) ? ((left - now) + 999) / 1000 : 0;
+
+		if( timeout < 0 || left < (uint64_t) timeout )
+			timeout = left;
+	}
+
+	return timeout;
+}